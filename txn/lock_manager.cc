@@ -5,13 +5,498 @@
 // 'The Case for Determinism in Database Systems'.
 
 #include "txn/lock_manager.h"
+
+#include <algorithm>
+#include <unistd.h>
+
 #include "txn/txn.h"
 
-LockManagerD::LockManagerD(deque<Txn*>* ready_txns) {
+// Number of consecutive keys in each stripe of a PartitionedLockManager's
+// key range partitioning.
+#define PARTITION_STRIPE_WIDTH 16
+
+// One in this many lock requests is profiled by each lock manager.
+#define LOCK_PROFILE_SAMPLE_RATE 16
+
+// Number of buckets in a LockProfiler's wait time histogram.
+#define WAIT_HISTOGRAM_BUCKETS 24
+
+// Number of consecutive keys in each LockManagerB lock range.
+#define LOCK_RANGE_WIDTH 1024
+
+// A batch holding more than this many keys of one range locks the whole
+// range instead.
+#define LOCK_ESCALATION_THRESHOLD 64
+
+void SortedLocks(const Txn* txn, vector<KeyLock>* locks) {
+  locks->clear();
+  locks->reserve(txn->readset_.size() + txn->writeset_.size());
+
+  set<Key>::const_iterator read = txn->readset_.begin();
+  set<Key>::const_iterator write = txn->writeset_.begin();
+  while (read != txn->readset_.end() or write != txn->writeset_.end()) {
+    if (write == txn->writeset_.end() or
+        (read != txn->readset_.end() and *read < *write)) {
+      locks->push_back(KeyLock(*read++, SHARED));
+    } else {
+      // a key that is both read and written only needs the write lock
+      if (read != txn->readset_.end() and *read == *write) {
+        ++read;
+      }
+      locks->push_back(KeyLock(*write++, EXCLUSIVE));
+    }
+  }
+}
+
+bool LockManager::AcquireAll(Txn* txn, const vector<KeyLock>& locks, bool wait) {
+  bool granted = true;
+  for (vector<KeyLock>::const_iterator it = locks.begin(); it != locks.end(); ++it) {
+    bool ok = (it->mode_ == EXCLUSIVE) ? WriteLock(txn, it->key_)
+                                       : ReadLock(txn, it->key_);
+    if (!ok) {
+      granted = false;
+      if (!wait) {
+        // cancel every request made so far, including the denied one
+        ReleaseAll(txn, vector<KeyLock>(locks.begin(), it + 1));
+        return false;
+      }
+    }
+  }
+  return granted;
+}
+
+void LockManager::ReleaseAll(Txn* txn, const vector<KeyLock>& locks) {
+  for (vector<KeyLock>::const_iterator it = locks.begin(); it != locks.end(); ++it) {
+    Release(txn, it->key_);
+  }
+}
+
+void LockManager::ReleaseEarly(Txn* txn, const vector<KeyLock>& locks) {
+  // an aborting txn wrote nothing, so reading past its locks is harmless
+  if (txn->Status() == COMPLETED_C) {
+    CommitState* state = &commit_states_[txn];
+    for (vector<KeyLock>::const_iterator it = locks.begin(); it != locks.end(); ++it) {
+      if (it->mode_ == EXCLUSIVE) {
+        violators_[it->key_] = txn;
+        state->violated_.push_back(it->key_);
+      }
+    }
+  }
+  ReleaseAll(txn, locks);
+}
+
+void LockManager::AddCommitDependencies(Txn* txn, const vector<KeyLock>& locks) {
+  for (vector<KeyLock>::const_iterator it = locks.begin(); it != locks.end(); ++it) {
+    unordered_map<Key, Txn*>::iterator violator = violators_.find(it->key_);
+    if (violator == violators_.end() or violator->second == txn) {
+      continue;
+    }
+
+    // a txn that violated several of these keys is depended on only once
+    vector<Txn*>* dependents = &commit_states_[violator->second].dependents_;
+    if (dependents->empty() or dependents->back() != txn) {
+      dependents->push_back(txn);
+      commit_states_[txn].waits_++;
+    }
+  }
+}
+
+bool LockManager::CommitBlocked(Txn* txn) {
+  unordered_map<Txn*, CommitState>::iterator state = commit_states_.find(txn);
+  if (state == commit_states_.end() or state->second.waits_ == 0) {
+    return false;
+  }
+  state->second.completed_ = true;
+  return true;
+}
+
+void LockManager::Committed(Txn* txn, vector<Txn*>* ready) {
+  unordered_map<Txn*, CommitState>::iterator state = commit_states_.find(txn);
+  if (state == commit_states_.end()) {
+    return;
+  }
+
+  // a key stays violated until its last early releaser commits
+  vector<Key>* violated = &state->second.violated_;
+  for (vector<Key>::iterator it = violated->begin(); it != violated->end(); ++it) {
+    unordered_map<Key, Txn*>::iterator violator = violators_.find(*it);
+    if (violator != violators_.end() and violator->second == txn) {
+      violators_.erase(violator);
+    }
+  }
+
+  vector<Txn*>* dependents = &state->second.dependents_;
+  for (vector<Txn*>::iterator it = dependents->begin(); it != dependents->end(); ++it) {
+    CommitState* dependent = &commit_states_[*it];
+    if (--dependent->waits_ == 0 and dependent->completed_) {
+      ready->push_back(*it);
+    }
+  }
+  commit_states_.erase(state);
+}
+
+bool LockManager::Compatible(const deque<LockRequest>& txnDeque, LockMode mode) {
+  // the queue is empty, or this is a read behind nothing but reads
+  for (deque<LockRequest>::const_iterator it = txnDeque.begin(); it != txnDeque.end(); ++it) {
+    if (mode == EXCLUSIVE or it->mode_ == EXCLUSIVE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+LockProfiler::LockProfiler(int sample_rate)
+    : sample_rate_(sample_rate), requests_(0),
+      histogram_(WAIT_HISTOGRAM_BUCKETS, 0) {
+}
+
+void LockProfiler::SetSampleRate(int sample_rate) {
+  sample_rate_ = sample_rate;
+}
+
+bool LockProfiler::RecordRequest(const Key& key, bool granted, int queue_depth) {
+  if (sample_rate_ == 0 or requests_++ % sample_rate_ != 0) {
+    return false;
+  }
+
+  mutex_.Lock();
+  KeyContention& stats = stats_[key];
+  stats.key_ = key;
+  stats.requests_++;
+  if (!granted) {
+    stats.denials_++;
+  }
+  if (queue_depth > stats.max_queue_depth_) {
+    stats.max_queue_depth_ = queue_depth;
+  }
+  mutex_.Unlock();
+  return true;
+}
+
+void LockProfiler::RecordWait(const Key& key, double seconds) {
+  // bucket i > 0 holds waits of [2^(i-1), 2^i) microseconds
+  int bucket = 0;
+  for (double us = seconds * 1000000; us >= 1 and bucket < WAIT_HISTOGRAM_BUCKETS - 1; us /= 2) {
+    bucket++;
+  }
+
+  mutex_.Lock();
+  KeyContention& stats = stats_[key];
+  stats.waits_++;
+  stats.wait_time_ += seconds;
+  histogram_[bucket]++;
+  mutex_.Unlock();
+}
+
+// orders keys hottest first
+static bool Hotter(const KeyContention& a, const KeyContention& b) {
+  if (a.denials_ != b.denials_) {
+    return a.denials_ > b.denials_;
+  }
+  return a.wait_time_ > b.wait_time_;
+}
+
+void LockProfiler::TopKeys(int k, vector<KeyContention>* top) {
+  top->clear();
+  mutex_.Lock();
+  for (unordered_map<Key, KeyContention>::iterator it = stats_.begin(); it != stats_.end(); ++it) {
+    top->push_back(it->second);
+  }
+  mutex_.Unlock();
+
+  if (static_cast<int>(top->size()) > k) {
+    std::partial_sort(top->begin(), top->begin() + k, top->end(), Hotter);
+    top->resize(k);
+  } else {
+    std::sort(top->begin(), top->end(), Hotter);
+  }
+}
+
+void LockProfiler::WaitHistogram(vector<uint64>* buckets) {
+  mutex_.Lock();
+  *buckets = histogram_;
+  mutex_.Unlock();
+}
+
+LockManager::LockManager()
+    : free_nodes_(NULL), profiler_(LOCK_PROFILE_SAMPLE_RATE) {
+}
+
+LockManager::~LockManager() {
+  for (unordered_map<Key, deque<LockRequest>*>::iterator it = lock_table_.begin();
+       it != lock_table_.end(); ++it) {
+    delete it->second;
+  }
+  for (unordered_map<Key, LockQueue*>::iterator it = lock_queues_.begin();
+       it != lock_queues_.end(); ++it) {
+    LockNode* node = it->second->head_;
+    while (node != NULL) {
+      LockNode* next = node->next_;
+      delete node;
+      node = next;
+    }
+    delete it->second;
+  }
+  for (unordered_map<Txn*, TxnLocks*>::iterator it = txn_locks_.begin();
+       it != txn_locks_.end(); ++it) {
+    delete it->second;
+  }
+  while (free_nodes_ != NULL) {
+    LockNode* next = free_nodes_->next_;
+    delete free_nodes_;
+    free_nodes_ = next;
+  }
+}
+
+LockManager::LockQueue* LockManager::QueueFor(const Key& key) {
+  LockQueue*& queue = lock_queues_[key];
+  if (queue == NULL) {
+    queue = new LockQueue();
+  }
+  return queue;
+}
+
+LockManager::TxnLocks* LockManager::LocksOf(Txn* txn) {
+  TxnLocks*& locks = txn_locks_[txn];
+  if (locks == NULL) {
+    locks = new TxnLocks();
+  }
+  return locks;
+}
+
+bool LockManager::Compatible(LockMode held, LockMode requested) {
+  switch (held) {
+    case INTENTION_SHARED:
+      return requested != EXCLUSIVE;
+    case INTENTION_EXCLUSIVE:
+      return requested == INTENTION_SHARED or requested == INTENTION_EXCLUSIVE;
+    case SHARED:
+      return requested == INTENTION_SHARED or requested == SHARED;
+    case EXCLUSIVE:
+      return false;
+    default:
+      return true;
+  }
+}
+
+bool LockManager::CompatibleWithHolders(const LockQueue* queue, LockMode mode) {
+  for (int m = SHARED; m <= INTENTION_EXCLUSIVE; m++) {
+    if (queue->held_[m] > 0 and !Compatible(static_cast<LockMode>(m), mode)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LockManager::Grantable(const LockQueue* queue, LockMode mode) {
+  // nothing is waiting, and the request is compatible with every holder
+  return queue->first_waiting_ == NULL and CompatibleWithHolders(queue, mode);
+}
+
+LockManager::LockNode* LockManager::Enqueue(Txn* txn, TxnLocks* locks,
+                                            LockQueue* queue, const Key& key,
+                                            LockMode mode, bool range) {
+  LockNode* node = free_nodes_;
+  if (node != NULL) {
+    free_nodes_ = node->next_;
+  } else {
+    node = new LockNode();
+  }
+  node->txn_ = txn;
+  node->key_ = key;
+  node->mode_ = mode;
+  node->granted_ = Grantable(queue, mode);
+  node->queue_ = queue;
+  node->owner_ = locks;
+  node->wait_start_ = 0;
+  node->range_ = range;
+  node->keys_ = 0;
+  node->parent_ = NULL;
+
+  // append to the key's queue
+  node->prev_ = queue->tail_;
+  node->next_ = NULL;
+  if (queue->tail_ != NULL) {
+    queue->tail_->next_ = node;
+  } else {
+    queue->head_ = node;
+  }
+  queue->tail_ = node;
+  queue->size_++;
+
+  // push onto the txn's chain
+  node->txn_prev_ = NULL;
+  node->txn_next_ = locks->locks_;
+  if (locks->locks_ != NULL) {
+    locks->locks_->txn_prev_ = node;
+  }
+  locks->locks_ = node;
+
+  if (node->granted_) {
+    queue->holders_++;
+    queue->held_[mode]++;
+  } else {
+    if (queue->first_waiting_ == NULL) {
+      queue->first_waiting_ = node;
+    }
+    locks->waits_++;
+  }
+
+  // range numbers would be confused with keys, so only keys are profiled
+  if (!range and profiler_.RecordRequest(key, node->granted_, queue->size_) and
+      !node->granted_) {
+    node->wait_start_ = GetTime();
+  }
+  return node;
+}
+
+LockManager::LockNode* LockManager::FindNode(Txn* txn, const Key& key) {
+  unordered_map<Txn*, TxnLocks*>::const_iterator it = txn_locks_.find(txn);
+  if (it == txn_locks_.end()) {
+    return NULL;
+  }
+  for (LockNode* node = it->second->locks_; node != NULL; node = node->txn_next_) {
+    if (node->key_ == key and !node->range_) {
+      return node;
+    }
+  }
+  return NULL;
+}
+
+void LockManager::Dequeue(LockNode* node) {
+  LockQueue* queue = node->queue_;
+  TxnLocks* locks = node->owner_;
+
+  // cancelling a request that was never granted means one less lock to wait on
+  if (node->granted_) {
+    queue->holders_--;
+    queue->held_[node->mode_]--;
+  } else {
+    if (queue->first_waiting_ == node) {
+      queue->first_waiting_ = node->next_;
+    }
+    locks->waits_--;
+    if (node->wait_start_ != 0) {
+      profiler_.RecordWait(node->key_, GetTime() - node->wait_start_);
+    }
+  }
+  queue->size_--;
+
+  // unlink from the key's queue
+  if (node->prev_ != NULL) {
+    node->prev_->next_ = node->next_;
+  } else {
+    queue->head_ = node->next_;
+  }
+  if (node->next_ != NULL) {
+    node->next_->prev_ = node->prev_;
+  } else {
+    queue->tail_ = node->prev_;
+  }
+
+  // unlink from the txn's chain
+  if (node->txn_prev_ != NULL) {
+    node->txn_prev_->txn_next_ = node->txn_next_;
+  } else {
+    locks->locks_ = node->txn_next_;
+  }
+  if (node->txn_next_ != NULL) {
+    node->txn_next_->txn_prev_ = node->txn_prev_;
+  }
+
+  Txn* txn = node->txn_;
+  node->next_ = free_nodes_;
+  free_nodes_ = node;
+
+  GrantWaiting(queue);
+
+  if (locks->locks_ == NULL) {
+    txn_locks_.erase(txn);
+    delete locks;
+  }
+}
+
+// Orders a KeyLock before a key, for binary searches of sorted lock sets.
+static bool KeyLockBefore(const KeyLock& lock, const Key& key) {
+  return lock.key_ < key;
+}
+
+void LockManager::DequeueAll(Txn* txn, const vector<KeyLock>& locks) {
+  unordered_map<Txn*, TxnLocks*>::const_iterator it = txn_locks_.find(txn);
+  if (it == txn_locks_.end()) {
+    return;
+  }
+
+  // one pass over the chain; the next node is taken before dequeueing, since
+  // dequeueing the last one frees the chain
+  LockNode* node = it->second->locks_;
+  while (node != NULL) {
+    LockNode* next = node->txn_next_;
+    vector<KeyLock>::const_iterator lock =
+        std::lower_bound(locks.begin(), locks.end(), node->key_, KeyLockBefore);
+    if (!node->range_ and lock != locks.end() and lock->key_ == node->key_) {
+      Dequeue(node);
+    }
+    node = next;
+  }
+}
+
+void LockManager::GrantWaiting(LockQueue* queue) {
+  // every request that enters the granted prefix is one less lock its txn is
+  // waiting on; txns that are no longer waiting at all are ready
+  while (queue->first_waiting_ != NULL) {
+    LockNode* node = queue->first_waiting_;
+    if (!CompatibleWithHolders(queue, node->mode_)) {
+      break;
+    }
+    node->granted_ = true;
+    queue->holders_++;
+    queue->held_[node->mode_]++;
+    queue->first_waiting_ = node->next_;
+    if (node->wait_start_ != 0) {
+      profiler_.RecordWait(node->key_, GetTime() - node->wait_start_);
+    }
+    if (--node->owner_->waits_ == 0) {
+      ready_txns_->push_back(node->txn_);
+    }
+  }
+}
+
+LockMode LockManager::QueueStatus(const Key& key, vector<Txn*>* owners) {
+  owners->clear();
+
+  unordered_map<Key, LockQueue*>::const_iterator it = lock_queues_.find(key);
+  if (it == lock_queues_.end() or it->second->holders_ == 0) {
+    return UNLOCKED;
+  }
+
+  // the owners are the granted prefix of the queue
+  LockQueue* queue = it->second;
+  for (LockNode* node = queue->head_; node != queue->first_waiting_; node = node->next_) {
+    owners->push_back(node->txn_);
+  }
+  return queue->head_->mode_;
+}
+
+bool LockManager::QueueReady(Txn* txn) {
+  unordered_map<Txn*, TxnLocks*>::const_iterator it = txn_locks_.find(txn);
+  return it == txn_locks_.end() or it->second->waits_ == 0;
+}
+
+LockManagerD::LockManagerD(deque<Txn*>* ready_txns)
+    : detector_started_(false), detector_stopped_(false),
+      detector_interval_(0) {
   ready_txns_ = ready_txns;
   pthread_mutex_init(&lock_table_lock_, NULL);
 }
 
+LockManagerD::~LockManagerD() {
+  if (detector_started_) {
+    detector_stopped_ = true;
+    pthread_join(detector_, NULL);
+  }
+}
+
 bool LockManagerD::WriteLock(Txn* txn, const Key& key) {
   // CPSC 438/538:
   //
@@ -26,6 +511,7 @@ bool LockManagerD::WriteLock(Txn* txn, const Key& key) {
     LockRequest lr(EXCLUSIVE, txn);
     newTxnDeque->push_back(lr);
     lock_table_.insert({key, newTxnDeque});
+    profiler_.RecordRequest(key, true, 1);
 
     // unlocks the lock table
     pthread_mutex_unlock(&lock_table_lock_);
@@ -38,10 +524,12 @@ bool LockManagerD::WriteLock(Txn* txn, const Key& key) {
       // push the transaction to the back of the deque
       LockRequest lr(EXCLUSIVE, txn);
       txnDeque->push_back(lr);
+      profiler_.RecordRequest(key, true, txnDeque->size());
       pthread_mutex_unlock(&lock_table_lock_);
       return true;
     }
 
+    profiler_.RecordRequest(key, false, txnDeque->size() + 1);
     pthread_mutex_unlock(&lock_table_lock_);
     return false;
   }
@@ -61,6 +549,7 @@ bool LockManagerD::ReadLock(Txn* txn, const Key& key) {
     LockRequest lr(SHARED, txn);
     newTxnDeque->push_back(lr);
     lock_table_.insert({key, newTxnDeque});
+    profiler_.RecordRequest(key, true, 1);
 
     // unlocks the lock table
     pthread_mutex_unlock(&lock_table_lock_);
@@ -81,10 +570,12 @@ bool LockManagerD::ReadLock(Txn* txn, const Key& key) {
       // push the transaction to the back of the deque
       LockRequest lr(SHARED, txn);
       txnDeque->push_back(lr);
+      profiler_.RecordRequest(key, true, txnDeque->size());
       pthread_mutex_unlock(&lock_table_lock_);
       return true;
     }
 
+    profiler_.RecordRequest(key, false, txnDeque->size() + 1);
     pthread_mutex_unlock(&lock_table_lock_);
     return false;
   }
@@ -95,260 +586,297 @@ void LockManagerD::Release(Txn* txn, const Key& key) {
   //
   // Implement this method!
 
-  // find the deque
   pthread_mutex_lock(&lock_table_lock_);
+  ReleaseLocked(txn, key);
+  pthread_mutex_unlock(&lock_table_lock_);
+}
+
+void LockManagerD::ReleaseLocked(Txn* txn, const Key& key) {
+  // find the deque
   unordered_map<Key, deque<LockRequest>*>::const_iterator it = lock_table_.find(key);
   if (it == lock_table_.end()){
-    pthread_mutex_unlock(&lock_table_lock_);
     return; 
-  } else {
-    deque<LockRequest> *txnDeque = it->second;
-    // iterate over elements of the deque to find the txn
-    for (deque<LockRequest>::iterator it = txnDeque->begin(); it != txnDeque->end(); ++it) {
-      if (it->txn_ == txn) {
-        txnDeque->erase(it);
-        break;
-      }
+  }
+  deque<LockRequest> *txnDeque = it->second;
+  // iterate over elements of the deque to find the txn
+  for (deque<LockRequest>::iterator it = txnDeque->begin(); it != txnDeque->end(); ++it) {
+    if (it->txn_ == txn) {
+      txnDeque->erase(it);
+      break;
     }
-
-    pthread_mutex_unlock(&lock_table_lock_);
   }
-}
 
-LockMode LockManagerD::Status(const Key& key, vector<Txn*>* owners) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
-
-  // clear owners first
-  owners->clear();
+  // hand the lock directly to whoever is parked at the front of the queue
+  GrantWaiters(txnDeque);
+}
 
-  unordered_map<Key, deque<LockRequest>*>::const_iterator it = lock_table_.find(key);
-  if (it == lock_table_.end()){
-    return UNLOCKED;
+bool LockManagerD::AcquireAll(Txn* txn, const vector<KeyLock>& locks, bool wait) {
+  if (wait) {
+    DIE("LockManagerD::AcquireAll cannot wait; use the blocking lock calls.");
   }
 
-  // return the first one because we require exclusive locks
-  // check if deque is empty first
-  deque<LockRequest> *txnDeque = it->second;
-  if (txnDeque->empty()) {
-    return UNLOCKED;
-  }
+  pthread_mutex_lock(&lock_table_lock_);
 
-  // return prefix of shared locks or first exclusive lock
-  bool sawShared = false;
-  for (deque<LockRequest>::iterator it = txnDeque->begin(); it != txnDeque->end(); ++it) {
-    if (it->mode_ == EXCLUSIVE and sawShared == false) {
-      owners->push_back(it->txn_);
-      return EXCLUSIVE;
-    } else if (it->mode_ == SHARED) {
-      owners->push_back(it->txn_);
-      sawShared = true;
-    } else if (sawShared) {
-      return SHARED;
-    } else {
-      return UNLOCKED;
+  // check the whole batch before enqueueing any of it, so that a denial
+  // leaves nothing behind to roll back
+  vector<deque<LockRequest>*> txnDeques(locks.size());
+  for (size_t i = 0; i < locks.size(); ++i) {
+    deque<LockRequest>*& txnDeque = lock_table_[locks[i].key_];
+    if (txnDeque == NULL) {
+      txnDeque = new deque<LockRequest>();
+    } else if (!Compatible(*txnDeque, locks[i].mode_)) {
+      profiler_.RecordRequest(locks[i].key_, false, txnDeque->size() + 1);
+      pthread_mutex_unlock(&lock_table_lock_);
+      return false;
     }
+    txnDeques[i] = txnDeque;
   }
 
-  return SHARED;
-}
+  for (size_t i = 0; i < locks.size(); ++i) {
+    txnDeques[i]->push_back(LockRequest(locks[i].mode_, txn));
+    profiler_.RecordRequest(locks[i].key_, true, txnDeques[i]->size());
+  }
 
-bool LockManagerD::ReadyExecute(Txn *txn) {
+  pthread_mutex_unlock(&lock_table_lock_);
   return true;
 }
 
+void LockManagerD::ReleaseAll(Txn* txn, const vector<KeyLock>& locks) {
+  pthread_mutex_lock(&lock_table_lock_);
+  for (vector<KeyLock>::const_iterator it = locks.begin(); it != locks.end(); ++it) {
+    ReleaseLocked(txn, it->key_);
+  }
+  pthread_mutex_unlock(&lock_table_lock_);
+}
 
-LockManagerC::LockManagerC(deque<Txn*>* ready_txns) {
-  ready_txns_ = ready_txns;
+bool LockManagerD::ReadLockBlocking(Txn* txn, const Key& key) {
+  return LockBlocking(txn, key, SHARED);
 }
 
-// now returns true if the txn is waiting on something with 
-// lower priority, or has already acquired the lock
-bool LockManagerC::WriteLock(Txn* txn, const Key& key) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
+bool LockManagerD::WriteLockBlocking(Txn* txn, const Key& key) {
+  return LockBlocking(txn, key, EXCLUSIVE);
+}
 
-  // find the key in the lock table
+bool LockManagerD::LockBlocking(Txn* txn, const Key& key, LockMode mode) {
+  LockWaiter waiter;
+  pthread_cond_init(&waiter.cv_, NULL);
+  waiter.granted_ = false;
+  waiter.aborted_ = false;
+
+  pthread_mutex_lock(&lock_table_lock_);
+  deque<LockRequest> *txnDeque;
   unordered_map<Key, deque<LockRequest>*>::const_iterator it = lock_table_.find(key);
   if (it == lock_table_.end()) {
-    // create a deque at the key
-    deque<LockRequest> *newTxnDeque = new deque<LockRequest>();
-    LockRequest lr(EXCLUSIVE, txn);
-    newTxnDeque->push_back(lr);
-    lock_table_.insert({key, newTxnDeque});
-    return true;
+    txnDeque = new deque<LockRequest>();
+    lock_table_.insert({key, txnDeque});
   } else {
-    deque<LockRequest> *txnDeque = it->second;
-    // push the transaction to the back of the deque
-    LockRequest lr(EXCLUSIVE, txn);
-    txnDeque->push_back(lr);
+    txnDeque = it->second;
+  }
 
-    // if it's the only transaction, then we grant the lock
-    if (txnDeque->size() == 1) {
-      return true;
+  // the request is granted right away if it is compatible with everything
+  // already in the queue, i.e. the queue is empty or it is a read behind
+  // nothing but reads
+  bool compatible = true;
+  for (deque<LockRequest>::iterator dit = txnDeque->begin(); dit != txnDeque->end(); ++dit) {
+    if (mode == EXCLUSIVE or dit->mode_ != SHARED) {
+      compatible = false;
+      break;
     }
+  }
 
-    // find transaction in txn_waits_
-    unordered_map<Txn*, int>::const_iterator waitIt = txn_waits_.find(txn);
-    // create new key if txn doesn't exist in txn_waits_
-    if (waitIt == txn_waits_.end()) {
-      txn_waits_.insert({txn, 1}); 
-    } else {
-      // increments value by 1 in txn_waits_
-      txn_waits_[txn] += 1;
+  bool profiled = profiler_.RecordRequest(key, compatible, txnDeque->size() + 1);
+  if (compatible) {
+    txnDeque->push_back(LockRequest(mode, txn));
+  } else {
+    // park until Release() grants the request or the deadlock detector
+    // aborts it; either way the waking thread unlinks the request from
+    // 'waiter' before 'waiter' goes out of scope
+    waiter.wait_start_ = GetTime();
+    txnDeque->push_back(LockRequest(mode, txn, &waiter));
+    waiting_on_[txn] = key;
+    while (!waiter.granted_ and !waiter.aborted_) {
+      pthread_cond_wait(&waiter.cv_, &lock_table_lock_);
     }
-
-    bool validWait = true;
-    for (deque<LockRequest>::iterator dit = txnDeque->begin(); dit != txnDeque->end(); ++dit) {
-      if (dit->txn_->unique_id_ <= txn->unique_id_) {
-        validWait = false;
-        break;
-      }
+    if (profiled) {
+      profiler_.RecordWait(key, GetTime() - waiter.wait_start_);
     }
-
-    return validWait;
   }
-}
 
-bool LockManagerC::ReadLock(Txn* txn, const Key& key) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
-  
-  // find the key in the lock table
-  unordered_map<Key, deque<LockRequest>*>::const_iterator it = lock_table_.find(key);
-  if (it == lock_table_.end()) {
-    // create a deque at the key
-    deque<LockRequest> *newTxnDeque = new deque<LockRequest>();
-    LockRequest lr(SHARED, txn);
-    newTxnDeque->push_back(lr);
-    lock_table_.insert({key, newTxnDeque});
-    return true;
-  } else {
-    deque<LockRequest> *txnDeque = it->second;
+  pthread_mutex_unlock(&lock_table_lock_);
+  pthread_cond_destroy(&waiter.cv_);
+  return !waiter.aborted_;
+}
 
-    // check if there has already been a read/write
-    // also stores whether there are only shared lock requests in the deque
-    bool onlyShared = true;
-    for (deque<LockRequest>::iterator dit = txnDeque->begin(); dit != txnDeque->end(); ++dit) {
-      if (dit->mode_ != SHARED) {
-        onlyShared = false;
-        break;
+void LockManagerD::GrantWaiters(deque<LockRequest>* txnDeque) {
+  // the granted prefix is either a single exclusive request or every shared
+  // request up to the first exclusive one
+  for (deque<LockRequest>::iterator it = txnDeque->begin(); it != txnDeque->end(); ++it) {
+    if (it->mode_ == EXCLUSIVE and it != txnDeque->begin()) {
+      break;
+    }
+
+    if (it->waiter_ != NULL) {
+      it->waiter_->granted_ = true;
+      pthread_cond_signal(&it->waiter_->cv_);
+      it->waiter_ = NULL;
+      waiting_on_.erase(it->txn_);
+    }
+
+    if (it->mode_ == EXCLUSIVE) {
+      break;
+    }
+  }
+}
+
+void LockManagerD::StartDeadlockDetector(double interval) {
+  detector_interval_ = interval;
+  detector_started_ = true;
+  pthread_create(&detector_, NULL, RunDeadlockDetector,
+                 reinterpret_cast<void*>(this));
+}
+
+void* LockManagerD::RunDeadlockDetector(void* arg) {
+  LockManagerD* lm = reinterpret_cast<LockManagerD*>(arg);
+  while (!lm->detector_stopped_) {
+    Sleep(lm->detector_interval_);
+    lm->DetectDeadlocks();
+  }
+  return NULL;
+}
+
+// Depth-first search from 'node'. If a back edge is found, sets '*cycle' to
+// the txns on the cycle and returns true.
+static bool VisitWaitsFor(const map<Txn*, set<Txn*> >& graph, Txn* node,
+                          map<Txn*, int>* color, vector<Txn*>* path,
+                          vector<Txn*>* cycle) {
+  // color: 0 = unvisited, 1 = on the current path, 2 = finished
+  (*color)[node] = 1;
+  path->push_back(node);
+
+  map<Txn*, set<Txn*> >::const_iterator it = graph.find(node);
+  if (it != graph.end()) {
+    for (set<Txn*>::const_iterator next = it->second.begin();
+         next != it->second.end(); ++next) {
+      if ((*color)[*next] == 1) {
+        cycle->assign(std::find(path->begin(), path->end(), *next), path->end());
+        return true;
+      }
+      if ((*color)[*next] == 0 and
+          VisitWaitsFor(graph, *next, color, path, cycle)) {
+        return true;
       }
     }
+  }
 
-    // push the transaction to the back of the deque
-    LockRequest lr(SHARED, txn);
-    txnDeque->push_back(lr);
+  (*color)[node] = 2;
+  path->pop_back();
+  return false;
+}
 
-    // if it's the only transaction, then we grant the lock
-    if (txnDeque->size() == 1 or onlyShared) {
+// Sets '*cycle' to some cycle of 'graph' and returns true, or returns false if
+// the graph is acyclic.
+static bool FindWaitsForCycle(const map<Txn*, set<Txn*> >& graph,
+                              vector<Txn*>* cycle) {
+  map<Txn*, int> color;
+  vector<Txn*> path;
+  for (map<Txn*, set<Txn*> >::const_iterator it = graph.begin();
+       it != graph.end(); ++it) {
+    if (color[it->first] == 0 and
+        VisitWaitsFor(graph, it->first, &color, &path, cycle)) {
       return true;
     }
+  }
+  return false;
+}
 
-    // find transaction in txn_waits_
-    unordered_map<Txn*, int>::const_iterator waitIt = txn_waits_.find(txn);
-    // create new key if txn doesn't exist in txn_waits_
-    if (waitIt == txn_waits_.end()) {
-      txn_waits_.insert({txn, 1}); 
-    } else {
-      // increments value by 1
-      txn_waits_[txn] += 1;
-    }
+void LockManagerD::DetectDeadlocks() {
+  pthread_mutex_lock(&lock_table_lock_);
 
-    bool validWait = true;
-    for (deque<LockRequest>::iterator dit = txnDeque->begin(); dit != txnDeque->end(); ++dit) {
-      if (dit->txn_->unique_id_ <= txn->unique_id_) {
-        validWait = false;
-        break;
+  // a cycle needs at least two parked txns
+  if (waiting_on_.size() < 2) {
+    pthread_mutex_unlock(&lock_table_lock_);
+    return;
+  }
+
+  double start = GetTime();
+  deadlock_stats_.detector_runs_++;
+
+  // build the waits-for graph; only parked txns have outgoing edges
+  map<Txn*, set<Txn*> > graph;
+  for (unordered_map<Txn*, Key>::iterator it = waiting_on_.begin();
+       it != waiting_on_.end(); ++it) {
+    WaitsFor(it->first, it->second, &graph[it->first]);
+  }
+
+  // break cycles one at a time by aborting the youngest txn on each
+  vector<Txn*> cycle;
+  while (FindWaitsForCycle(graph, &cycle)) {
+    Txn* victim = cycle[0];
+    for (vector<Txn*>::iterator it = cycle.begin(); it != cycle.end(); ++it) {
+      if ((*it)->unique_id_ > victim->unique_id_) {
+        victim = *it;
       }
     }
 
-    return validWait;
+    AbortWaiter(victim);
+    graph.erase(victim);
   }
+
+  deadlock_stats_.total_run_time_ += GetTime() - start;
+  pthread_mutex_unlock(&lock_table_lock_);
 }
 
-void LockManagerC::Release(Txn* txn, const Key& key) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
+void LockManagerD::WaitsFor(Txn* txn, const Key& key, set<Txn*>* edges) {
+  deque<LockRequest> *txnDeque = lock_table_[key];
 
-  // find the deque
-  unordered_map<Key, deque<LockRequest>*>::const_iterator it = lock_table_.find(key);
-  if (it == lock_table_.end()){
-    return; 
-  } else {
-    deque<LockRequest> *txnDeque = it->second;
-    bool first = true;
-    bool onlyShared = true;
-    // iterate over elements of the deque to find the txn
-    for (deque<LockRequest>::iterator it = txnDeque->begin(); it != txnDeque->end(); ++it) {
-      if (it->txn_ == txn) {
-        // remembers the next iterator
-        deque<LockRequest>::iterator nextIt = it + 1;
-        if (nextIt == txnDeque->end()) {
-          // erases old entry
-          unordered_map<Txn*, int>::const_iterator waitIt = txn_waits_.find(txn);
-          if (waitIt != txn_waits_.end()) {
-            // decrements in wait table
-            txn_waits_[txn] -= 1;
-          }
-
-          txnDeque->erase(it);
-          return;
-        }
-        
-        if ((onlyShared and it->mode_ == EXCLUSIVE) or
-            (first and it->mode_ == SHARED and nextIt->mode_ == EXCLUSIVE)) {
-          // removes a prefix of shared locks from the wait table
-          // or starts the next exclusive lock
-          first = true;
-          for (; nextIt != txnDeque->end(); ++nextIt) {
-            if ((first and nextIt->mode_ == EXCLUSIVE) or
-                (nextIt->mode_ == SHARED)) {
-              unordered_map<Txn*, int>::const_iterator waitIt = txn_waits_.find(nextIt->txn_);
-              if (waitIt != txn_waits_.end()) {
-                // decrements in wait table
-                if (waitIt->second == 1) {
-                  txn_waits_.erase(waitIt);
-                  ready_txns_->push_back(nextIt->txn_);
-                } else {
-                  txn_waits_[nextIt->txn_] -= 1;
-                }
-              }
-
-              // ends prefix if we remove an exclusive lock from waiting
-              if (nextIt->mode_ == EXCLUSIVE) {
-                break;
-              }
-            } else if (nextIt->mode_ == EXCLUSIVE) {
-              break;
-            } else {
-              printf("A HUGE ERROR HAS OCCURRED\n");
-            }
-
-            first = false;
-          }
-        }
+  LockMode mode = SHARED;
+  for (deque<LockRequest>::iterator it = txnDeque->begin(); it != txnDeque->end(); ++it) {
+    if (it->txn_ == txn) {
+      mode = it->mode_;
+      break;
+    }
+  }
 
-        // erases old entry
-        txnDeque->erase(it);
-        return;
-      }
+  // a parked request waits for every incompatible request ahead of it, both
+  // holders and earlier waiters, since the queue is granted in order
+  for (deque<LockRequest>::iterator it = txnDeque->begin(); it != txnDeque->end(); ++it) {
+    if (it->txn_ == txn) {
+      break;
+    }
+    if (mode == EXCLUSIVE or it->mode_ == EXCLUSIVE) {
+      edges->insert(it->txn_);
+    }
+  }
+}
 
-      // check if prefixed by shared locks
-      if (it->mode_ != SHARED) {
-        onlyShared = false;
-      }
+void LockManagerD::AbortWaiter(Txn* victim) {
+  deque<LockRequest> *txnDeque = lock_table_[waiting_on_[victim]];
+  waiting_on_.erase(victim);
 
-      first = false;
+  for (deque<LockRequest>::iterator it = txnDeque->begin(); it != txnDeque->end(); ++it) {
+    if (it->txn_ == victim) {
+      deadlock_stats_.deadlocks_++;
+      deadlock_stats_.total_latency_ += GetTime() - it->waiter_->wait_start_;
+
+      it->waiter_->aborted_ = true;
+      pthread_cond_signal(&it->waiter_->cv_);
+      txnDeque->erase(it);
+      break;
     }
   }
+
+  // requests queued behind the victim may now be compatible with the holders
+  GrantWaiters(txnDeque);
 }
 
-LockMode LockManagerC::Status(const Key& key, vector<Txn*>* owners) {
+DeadlockStats LockManagerD::GetDeadlockStats() {
+  pthread_mutex_lock(&lock_table_lock_);
+  DeadlockStats stats = deadlock_stats_;
+  pthread_mutex_unlock(&lock_table_lock_);
+  return stats;
+}
+
+LockMode LockManagerD::Status(const Key& key, vector<Txn*>* owners) {
   // CPSC 438/538:
   //
   // Implement this method!
@@ -380,7 +908,6 @@ LockMode LockManagerC::Status(const Key& key, vector<Txn*>* owners) {
     } else if (sawShared) {
       return SHARED;
     } else {
-      printf("SHOULDNT GET HERE: ERROR\n");
       return UNLOCKED;
     }
   }
@@ -388,18 +915,96 @@ LockMode LockManagerC::Status(const Key& key, vector<Txn*>* owners) {
   return SHARED;
 }
 
-// returns true if the transaction is not waiting on anything
-bool LockManagerC::ReadyExecute(Txn *txn) {
-  unordered_map<Txn*, int>::const_iterator waitIt = txn_waits_.find(txn);
-  if (waitIt != txn_waits_.end()) {
-    // decrements in wait table
-    if (waitIt->second > 0) {
-      return false;
-    } else {
-      txn_waits_.erase(waitIt);
+bool LockManagerD::ReadyExecute(Txn *txn) {
+  return true;
+}
+
+
+LockManagerC::LockManagerC(deque<Txn*>* ready_txns, DeadlockPolicy policy)
+    : policy_(policy) {
+  ready_txns_ = ready_txns;
+}
+
+// returns true if the txn has acquired the lock or may wait for it, and
+// false if it must die
+bool LockManagerC::WriteLock(Txn* txn, const Key& key) {
+  return Lock(txn, key, EXCLUSIVE);
+}
+
+bool LockManagerC::ReadLock(Txn* txn, const Key& key) {
+  return Lock(txn, key, SHARED);
+}
+
+bool LockManagerC::Lock(Txn* txn, const Key& key, LockMode mode) {
+  LockQueue* queue = QueueFor(key);
+
+  // collect every request ahead of this one that it conflicts with
+  vector<Txn*> conflicts;
+  for (LockNode* node = queue->head_; node != NULL; node = node->next_) {
+    if (mode == EXCLUSIVE or node->mode_ == EXCLUSIVE) {
+      conflicts.push_back(node->txn_);
     }
   }
-  return true;
+
+  // granted if compatible with everything already queued; otherwise the
+  // request stays queued (so the caller can cancel it with Release) and is
+  // counted as one more lock this txn is waiting on
+  if (Enqueue(txn, LocksOf(txn), queue, key, mode)->granted_) {
+    return true;
+  }
+
+  bool mayWait = false;
+  if (policy_ == WAIT_DIE) {
+    // wait only if older than every conflicting txn
+    mayWait = true;
+    for (vector<Txn*>::iterator cit = conflicts.begin(); cit != conflicts.end(); ++cit) {
+      if ((*cit)->unique_id_ <= txn->unique_id_) {
+        mayWait = false;
+        break;
+      }
+    }
+  } else if (policy_ == WOUND_WAIT) {
+    // always wait, but wound every younger conflicting txn
+    mayWait = true;
+    for (vector<Txn*>::iterator cit = conflicts.begin(); cit != conflicts.end(); ++cit) {
+      if ((*cit)->unique_id_ > txn->unique_id_) {
+        wounded_.insert(*cit);
+      }
+    }
+  }
+
+  return mayWait;
+}
+
+void LockManagerC::TakeWoundedTxns(vector<Txn*>* wounded) {
+  wounded->clear();
+  for (set<Txn*>::iterator it = wounded_.begin(); it != wounded_.end(); ++it) {
+    // a wounded txn that already holds all of its locks is left to finish
+    if (!QueueReady(*it)) {
+      wounded->push_back(*it);
+    }
+  }
+  wounded_.clear();
+}
+
+void LockManagerC::Release(Txn* txn, const Key& key) {
+  LockNode* node = FindNode(txn, key);
+  if (node != NULL) {
+    Dequeue(node);
+  }
+}
+
+void LockManagerC::ReleaseAll(Txn* txn, const vector<KeyLock>& locks) {
+  DequeueAll(txn, locks);
+}
+
+LockMode LockManagerC::Status(const Key& key, vector<Txn*>* owners) {
+  return QueueStatus(key, owners);
+}
+
+// returns true if the transaction is not waiting on anything
+bool LockManagerC::ReadyExecute(Txn *txn) {
+  return QueueReady(txn);
 }
 
 LockManagerA::LockManagerA(deque<Txn*>* ready_txns) {
@@ -407,10 +1012,19 @@ LockManagerA::LockManagerA(deque<Txn*>* ready_txns) {
 }
 
 bool LockManagerA::WriteLock(Txn* txn, const Key& key) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
-  return true;
+  deque<LockRequest>*& requests = lock_table_[key];
+  if (requests == NULL) {
+    requests = new deque<LockRequest>();
+  }
+
+  // granted only if no one else holds or waits for the key
+  requests->push_back(LockRequest(EXCLUSIVE, txn));
+  profiler_.RecordRequest(key, requests->size() == 1, requests->size());
+  if (requests->size() == 1) {
+    return true;
+  }
+  txn_waits_[txn]++;
+  return false;
 }
 
 bool LockManagerA::ReadLock(Txn* txn, const Key& key) {
@@ -420,261 +1034,429 @@ bool LockManagerA::ReadLock(Txn* txn, const Key& key) {
 }
 
 void LockManagerA::Release(Txn* txn, const Key& key) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
+  unordered_map<Key, deque<LockRequest>*>::iterator it = lock_table_.find(key);
+  if (it == lock_table_.end()) {
+    return;
+  }
+  deque<LockRequest>* requests = it->second;
+  for (deque<LockRequest>::iterator request = requests->begin();
+       request != requests->end(); ++request) {
+    if (request->txn_ != txn) {
+      continue;
+    }
+
+    // a released lock passes to the next request in line
+    bool owner = (request == requests->begin());
+    requests->erase(request);
+    if (owner and !requests->empty()) {
+      Txn* next = requests->front().txn_;
+      unordered_map<Txn*, int>::iterator waits = txn_waits_.find(next);
+      if (waits != txn_waits_.end() and --waits->second == 0) {
+        txn_waits_.erase(waits);
+        ready_txns_->push_back(next);
+      }
+    }
+    break;
+  }
+
+  // a txn releasing a lock is no longer waiting on any
+  txn_waits_.erase(txn);
 }
 
 LockMode LockManagerA::Status(const Key& key, vector<Txn*>* owners) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
-  return UNLOCKED;
+  owners->clear();
+  unordered_map<Key, deque<LockRequest>*>::iterator it = lock_table_.find(key);
+  if (it == lock_table_.end() or it->second->empty()) {
+    return UNLOCKED;
+  }
+  owners->push_back(it->second->front().txn_);
+  return EXCLUSIVE;
 }
 
 bool LockManagerA::ReadyExecute(Txn *txn) {
-  return true;
+  return txn_waits_.count(txn) == 0;
 }
 
 LockManagerB::LockManagerB(deque<Txn*>* ready_txns) {
   ready_txns_ = ready_txns;
 }
 
-bool LockManagerB::WriteLock(Txn* txn, const Key& key) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
+LockManagerB::~LockManagerB() {
+  for (unordered_map<uint64, LockQueue*>::iterator it = range_queues_.begin();
+       it != range_queues_.end(); ++it) {
+    LockNode* node = it->second->head_;
+    while (node != NULL) {
+      LockNode* next = node->next_;
+      delete node;
+      node = next;
+    }
+    delete it->second;
+  }
+}
 
-  bool granted = false;
+bool LockManagerB::WriteLock(Txn* txn, const Key& key) {
+  return Lock(txn, key, EXCLUSIVE);
+}
 
-  if (lock_table_.count(key) == 0) {
-    deque<LockRequest>* newDeque;
-    newDeque = new deque<LockRequest>();
-    lock_table_[key] = newDeque;
-    granted = true;
-  }
-  else {
-    if (txn_waits_.count(txn) == 0)
-      txn_waits_[txn] = 1;
-    else 
-      txn_waits_[txn]++;
-  }
+bool LockManagerB::ReadLock(Txn* txn, const Key& key) {
+  return Lock(txn, key, SHARED);
+}
 
-  lock_table_[key]->push_back(LockRequest(EXCLUSIVE, txn));
+bool LockManagerB::Lock(Txn* txn, const Key& key, LockMode mode) {
+  return LockKey(txn, LocksOf(txn), key, mode);
+}
 
-  if (lock_table_[key]->size() == 1) {
-    granted = true;
+LockManager::LockQueue* LockManagerB::RangeQueueFor(uint64 range) {
+  LockQueue*& queue = range_queues_[range];
+  if (queue == NULL) {
+    queue = new LockQueue();
   }
+  return queue;
+}
 
-  return granted;
+LockManager::LockNode* LockManagerB::FindRangeNode(TxnLocks* locks, uint64 range,
+                                                   LockMode mode) {
+  for (LockNode* node = locks->locks_; node != NULL; node = node->txn_next_) {
+    if (node->range_ and node->key_ == range and node->mode_ == mode) {
+      return node;
+    }
+  }
+  return NULL;
 }
 
-bool LockManagerB::ReadLock(Txn* txn, const Key& key) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
+LockManager::LockNode* LockManagerB::CoveringRangeNode(TxnLocks* locks,
+                                                       const Key& key,
+                                                       LockMode mode) {
+  uint64 range = key / LOCK_RANGE_WIDTH;
+  LockNode* node = FindRangeNode(locks, range, EXCLUSIVE);
+  if (node == NULL and mode == SHARED) {
+    node = FindRangeNode(locks, range, SHARED);
+  }
+  return node;
+}
 
-  bool granted = false;
+bool LockManagerB::LockKey(Txn* txn, TxnLocks* locks, const Key& key, LockMode mode) {
+  locks->keys_++;
 
-  if (lock_table_.count(key) == 0) {
-    deque<LockRequest>* newDeque;
-    newDeque = new deque<LockRequest>();
-    lock_table_[key] = newDeque;
-    granted = true;
+  // a range lock the txn already holds covers the key outright
+  LockNode* range = CoveringRangeNode(locks, key, mode);
+  if (range != NULL) {
+    range->keys_++;
+    return range->granted_;
   }
-  else {
-    if (txn_waits_.count(txn) == 0)
-      txn_waits_[txn] = 1;
-    else 
-      txn_waits_[txn]++;
-  }
-
-  lock_table_[key]->push_back(LockRequest(SHARED, txn));
 
-  bool allShared = true;
-  int size = lock_table_[key]->size();
-  for (int i = 0; i < size; i++) {
-    LockRequest temp = lock_table_[key]->at(i);
-    if (temp.mode_ != SHARED) {
-      allShared = false;
-    }
+  // otherwise announce the key lock on its range first; an IX lock also
+  // announces reads
+  uint64 number = key / LOCK_RANGE_WIDTH;
+  LockMode intention = (mode == EXCLUSIVE) ? INTENTION_EXCLUSIVE : INTENTION_SHARED;
+  LockNode* parent = FindRangeNode(locks, number, INTENTION_EXCLUSIVE);
+  if (parent == NULL and intention == INTENTION_SHARED) {
+    parent = FindRangeNode(locks, number, INTENTION_SHARED);
   }
-  if (allShared) {
-    granted = true;
+  if (parent == NULL) {
+    parent = Enqueue(txn, locks, RangeQueueFor(number), number, intention, true);
   }
+  parent->keys_++;
 
-  return granted;
+  // granted iff compatible with everything already queued
+  LockNode* node = Enqueue(txn, locks, QueueFor(key), key, mode);
+  node->parent_ = parent;
+  return node->granted_ and parent->granted_;
 }
 
-void LockManagerB::Release(Txn* txn, const Key& key) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
+bool LockManagerB::LockRange(Txn* txn, TxnLocks* locks, uint64 range,
+                             LockMode mode, int keys) {
+  locks->keys_ += keys;
+  LockNode* node = Enqueue(txn, locks, RangeQueueFor(range), range, mode, true);
+  node->keys_ = keys;
+  return node->granted_;
+}
 
-  // int size = lock_table_[key]->size();
-  // int index = 0;
-  // for (int i = 0; i < size; i++) {
-  //   LockRequest temp = lock_table_[key]->front();
-  //   lock_table_[key]->pop_front();
-  //   if (temp.txn_ == txn) {
-  //     index = i;
-  //   }
-  //   if (temp.txn_ != txn) {
-  //     lock_table_[key]->push_back(temp);
-  //   }
-  // }
-  // size = lock_table_[key]->size();
-  // if (!(lock_table_[key]->empty()) && size > index) {
-  //   LockRequest next = (lock_table_[key]->at(index));
-  //   txn_waits_[next.txn_] -= 1;
-  //   if (txn_waits_[next.txn_] == 0) {
-  //     ready_txns_->push_back(next.txn_);
-  //   }
-  //   if (next.mode_ == SHARED && size > index + 1){
-  //     for (int i = index + 1; i < size; i++) {
-  //       LockRequest temp = lock_table_[key]->at(i);
-  //       if (temp.mode_ == EXCLUSIVE) {
-  //         break;
-  //       }
-  //       txn_waits_[temp.txn_] -= 1;
-  //       if (txn_waits_[temp.txn_] == 0) {
-  //         ready_txns_->push_back(temp.txn_);
-  //       }
-  //     }
-  //   }
-  // }
-
-  bool first = false;
-  bool exclusive = false;
-  int next = 0;
-  bool beforeExc = true;
-
-  if (lock_table_.count(key) != 0) {
-
-    // iterate through the lock table & delete the txn
-    for (std::deque<LockRequest>::iterator it = lock_table_[key]->begin();
-     it != lock_table_[key]->end(); ++it) {
-      if (it->txn_ == txn) {
-        if (it == lock_table_[key]->begin()){
-          first = true;
-        }
-        if (it->mode_ == EXCLUSIVE) {
-          exclusive = true;
-        }
-        lock_table_[key]->erase(it);
-        break;
-      }
-      if (it->mode_ == EXCLUSIVE) {
-        beforeExc = false;
+bool LockManagerB::AcquireAll(Txn* txn, const vector<KeyLock>& locks, bool wait) {
+  if (locks.empty()) {
+    return true;
+  }
+
+  // the batch is sorted, so each range's keys are contiguous. Plan every
+  // range before requesting anything: a range with many keys in the batch
+  // is locked as a whole, unless the txn already holds locks on it
+  struct RangePlan {
+    uint64 range_;
+    size_t begin_, end_;
+    LockMode mode_;       // Strongest key mode in the range.
+    LockNode* covering_;  // Txn's range lock covering every key, or NULL.
+    bool escalate_;
+  };
+  TxnLocks* txnLocks = LocksOf(txn);
+  vector<RangePlan> plans;
+  for (size_t i = 0; i < locks.size(); ) {
+    RangePlan plan;
+    plan.range_ = locks[i].key_ / LOCK_RANGE_WIDTH;
+    plan.begin_ = i;
+    plan.mode_ = SHARED;
+    while (i < locks.size() and locks[i].key_ / LOCK_RANGE_WIDTH == plan.range_) {
+      if (locks[i].mode_ == EXCLUSIVE) {
+        plan.mode_ = EXCLUSIVE;
       }
-      next++;
+      ++i;
     }
+    plan.end_ = i;
+    plan.covering_ = CoveringRangeNode(txnLocks, locks[plan.begin_].key_, plan.mode_);
+    plan.escalate_ =
+        plan.covering_ == NULL and
+        plan.end_ - plan.begin_ > LOCK_ESCALATION_THRESHOLD and
+        FindRangeNode(txnLocks, plan.range_, SHARED) == NULL and
+        FindRangeNode(txnLocks, plan.range_, INTENTION_SHARED) == NULL and
+        FindRangeNode(txnLocks, plan.range_, INTENTION_EXCLUSIVE) == NULL;
+    plans.push_back(plan);
   }
 
-  // update the wait queue accordingly
-  if (lock_table_.count(key) != 0) {
-    if (first && exclusive) {
-      if (lock_table_[key]->size() > 0) {
-        LockRequest front = lock_table_[key]->front();
-        if (front.mode_ == EXCLUSIVE){
-          txn_waits_[front.txn_] -= 1;
-          if (txn_waits_[front.txn_] == 0) {
-            ready_txns_->push_back(front.txn_);
-          }
-        }
-        else {
-          for (std::deque<LockRequest>::iterator it = lock_table_[key]->begin();
-           it != lock_table_[key]->end(); ++it) {
-            if (it->mode_ == EXCLUSIVE) {
-              break;
-            }
-            txn_waits_[it->txn_] -= 1;
-            if (txn_waits_[it->txn_] == 0) {
-              ready_txns_->push_back(it->txn_);
-            }
-          }
+  // without waiting, a denial leaves nothing behind to roll back. A txn's
+  // own intention locks never conflict with its other requests
+  if (!wait) {
+    bool grantable = true;
+    for (size_t p = 0; grantable and p < plans.size(); ++p) {
+      const RangePlan& plan = plans[p];
+      if (plan.covering_ != NULL) {
+        grantable = plan.covering_->granted_;
+        continue;
+      }
+      LockQueue* rangeQueue = RangeQueueFor(plan.range_);
+      if (plan.escalate_) {
+        grantable = Grantable(rangeQueue, plan.mode_);
+        continue;
+      }
+      for (size_t i = plan.begin_; grantable and i < plan.end_; ++i) {
+        LockQueue* queue = QueueFor(locks[i].key_);
+        if (!Grantable(queue, locks[i].mode_)) {
+          profiler_.RecordRequest(locks[i].key_, false, queue->size_ + 1);
+          grantable = false;
         }
       }
+      LockMode intention =
+          (plan.mode_ == EXCLUSIVE) ? INTENTION_EXCLUSIVE : INTENTION_SHARED;
+      LockNode* held = FindRangeNode(txnLocks, plan.range_, intention);
+      if (grantable and (held != NULL ? !held->granted_
+                                      : !Grantable(rangeQueue, intention))) {
+        grantable = false;
+      }
+    }
+    if (!grantable) {
+      if (txnLocks->locks_ == NULL) {
+        txn_locks_.erase(txn);
+        delete txnLocks;
+      }
+      return false;
     }
-    else if (exclusive && beforeExc) {
-      if (lock_table_[key]->size() > 0) {
-        // bool exc = false;
-        int index = 0;
-        // for (std::deque<LockRequest>::iterator it = lock_table_[key]->begin();
-        //    it != lock_table_[key]->end(); ++it) {
-        //   if (index == next){
-        //     if (it->mode_ == EXCLUSIVE){
-        //       txn_waits_[it->txn_] -= 1;
-        //       exc = true;
-        //       if (txn_waits_[it->txn_] == 0) {
-        //         ;//ready_txns_->push_back(it->txn_);
-        //       }
-        //       break;
-        //     }
-        //   }
-        //   index++;
-        // }
-        // index = 0;
-        // if (!exc){
-          for (std::deque<LockRequest>::iterator it = lock_table_[key]->begin();
-           it != lock_table_[key]->end(); ++it) {
-            if (index < next) {
-              continue;
-            }
-            if (it->mode_ == EXCLUSIVE) {
-              break;
-            }
-            txn_waits_[it->txn_] -= 1;
-            if (txn_waits_[it->txn_] == 0) {
-              ready_txns_->push_back(it->txn_);
-            }
-            index++;
-          }
-        // }
+  }
+
+  for (vector<RangePlan>::iterator plan = plans.begin(); plan != plans.end(); ++plan) {
+    if (plan->covering_ != NULL) {
+      plan->covering_->keys_ += plan->end_ - plan->begin_;
+      txnLocks->keys_ += plan->end_ - plan->begin_;
+    } else if (plan->escalate_) {
+      LockRange(txn, txnLocks, plan->range_, plan->mode_, plan->end_ - plan->begin_);
+    } else {
+      for (size_t i = plan->begin_; i < plan->end_; ++i) {
+        LockKey(txn, txnLocks, locks[i].key_, locks[i].mode_);
       }
     }
-    // else if (lock_table_[key]->size() == 0) {
-    //   lock_table_.erase(key);
-    // }
-  } 
-  // if (lock_table_[key]->size() == 0) {
-  //   lock_table_.erase(key);
-  // }
-  if (txn_waits_.count(txn) != 0) {
-      txn_waits_.erase(txn);
+  }
+  return txnLocks->waits_ == 0;
+}
+
+void LockManagerB::Release(Txn* txn, const Key& key) {
+  unordered_map<Txn*, TxnLocks*>::const_iterator it = txn_locks_.find(txn);
+  if (it == txn_locks_.end()) {
+    return;
+  }
+  TxnLocks* locks = it->second;
+
+  // a key lock and then, with its last key, the intention lock above it; or
+  // one key's share of a range lock. The txn's chain (and 'locks') is freed
+  // with its last node, so it is not touched after that
+  LockNode* range;
+  LockNode* node = FindNode(txn, key);
+  if (node != NULL) {
+    range = node->parent_;
+    locks->keys_--;
+    Dequeue(node);
+  } else {
+    range = CoveringRangeNode(locks, key, SHARED);
+    if (range == NULL) {
+      return;
+    }
+    locks->keys_--;
+  }
+  if (range != NULL and --range->keys_ == 0) {
+    Dequeue(range);
+  }
+}
+
+void LockManagerB::ReleaseAll(Txn* txn, const vector<KeyLock>& locks) {
+  unordered_map<Txn*, TxnLocks*>::const_iterator it = txn_locks_.find(txn);
+  if (it == txn_locks_.end()) {
+    return;
+  }
+
+  // releasing every key the txn requested releases its whole chain,
+  // including its range locks
+  if (locks.size() < static_cast<size_t>(it->second->keys_)) {
+    for (vector<KeyLock>::const_iterator lock = locks.begin(); lock != locks.end(); ++lock) {
+      Release(txn, lock->key_);
+    }
+    return;
+  }
+  LockNode* node = it->second->locks_;
+  while (node != NULL) {
+    LockNode* next = node->txn_next_;
+    Dequeue(node);
+    node = next;
   }
 }
 
 LockMode LockManagerB::Status(const Key& key, vector<Txn*>* owners) {
-  // CPSC 438/538:
-  //
-  // Implement this method!
+  LockMode mode = QueueStatus(key, owners);
 
-  owners->clear();
+  // txns holding the key's whole range own the key too
+  unordered_map<uint64, LockQueue*>::const_iterator it =
+      range_queues_.find(key / LOCK_RANGE_WIDTH);
+  if (it == range_queues_.end()) {
+    return mode;
+  }
+  LockQueue* queue = it->second;
+  for (LockNode* node = queue->head_; node != queue->first_waiting_; node = node->next_) {
+    if (node->mode_ == SHARED or node->mode_ == EXCLUSIVE) {
+      owners->push_back(node->txn_);
+      if (mode != EXCLUSIVE) {
+        mode = node->mode_;
+      }
+    }
+  }
+  return mode;
+}
 
-  int size = lock_table_[key]->size();
-  if (size == 0) {
-    return UNLOCKED;
+// returns true if the transaction is not waiting on anything
+bool LockManagerB::ReadyExecute(Txn *txn) {
+  return QueueReady(txn);
+}
+
+PartitionedLockManager::PartitionedLockManager(int partitions)
+    : stopped_(false), split_(partitions) {
+  for (int i = 0; i < partitions; i++) {
+    partitions_.push_back(new Partition(this));
   }
-  else {
-    LockRequest front = lock_table_[key]->front();
-    if (front.mode_ == EXCLUSIVE) {
-      owners->push_back(front.txn_);
-      return EXCLUSIVE;
+  for (int i = 0; i < partitions; i++) {
+    pthread_create(&partitions_[i]->thread_, NULL, RunPartition,
+                   reinterpret_cast<void*>(partitions_[i]));
+  }
+}
+
+PartitionedLockManager::~PartitionedLockManager() {
+  stopped_ = true;
+  for (size_t i = 0; i < partitions_.size(); i++) {
+    pthread_join(partitions_[i]->thread_, NULL);
+    delete partitions_[i];
+  }
+}
+
+int PartitionedLockManager::PartitionOf(const Key& key) const {
+  return (key / PARTITION_STRIPE_WIDTH) % partitions_.size();
+}
+
+void PartitionedLockManager::Acquire(Txn* txn) {
+  int partitions = Split(txn);
+  if (partitions == 0) {
+    ready_.Push(txn);
+    return;
+  }
+
+  // the count must be in place before any partition can finish granting
+  pending_mutex_.Lock();
+  pending_partitions_[txn] = partitions;
+  pending_mutex_.Unlock();
+
+  Post(txn, false);
+}
+
+void PartitionedLockManager::Release(Txn* txn) {
+  Split(txn);
+  Post(txn, true);
+}
+
+bool PartitionedLockManager::NextReady(Txn** txn) {
+  return ready_.Pop(txn);
+}
+
+int PartitionedLockManager::Split(Txn* txn) {
+  // 'locks_' is sorted by key, so each partition's share stays sorted
+  SortedLocks(txn, &locks_);
+  int partitions = 0;
+  for (vector<KeyLock>::iterator it = locks_.begin(); it != locks_.end(); ++it) {
+    vector<KeyLock>* share = &split_[PartitionOf(it->key_)];
+    if (share->empty()) {
+      partitions++;
     }
-    for (int i = 0; i < size; i++) {
-      LockRequest temp = lock_table_[key]->at(i);
-      if (temp.mode_ == EXCLUSIVE) {
-        break;
-      }
-      owners->push_back(temp.txn_);
+    share->push_back(*it);
+  }
+  return partitions;
+}
+
+void PartitionedLockManager::Post(Txn* txn, bool release) {
+  for (size_t i = 0; i < split_.size(); i++) {
+    if (split_[i].empty()) {
+      continue;
     }
-    return SHARED;
+    LockMessage message;
+    message.txn_ = txn;
+    message.release_ = release;
+    message.locks_.swap(split_[i]);
+    partitions_[i]->messages_.Push(message);
   }
 }
 
-bool LockManagerB::ReadyExecute(Txn *txn){
-  return true;
+void PartitionedLockManager::PartitionGranted(Txn* txn) {
+  pending_mutex_.Lock();
+  unordered_map<Txn*, int>::iterator it = pending_partitions_.find(txn);
+  bool ready = (--it->second == 0);
+  if (ready) {
+    pending_partitions_.erase(it);
+  }
+  pending_mutex_.Unlock();
+
+  if (ready) {
+    ready_.Push(txn);
+  }
 }
 
+void* PartitionedLockManager::RunPartition(void* arg) {
+  Partition* partition = reinterpret_cast<Partition*>(arg);
+
+  LockMessage message;
+  int sleep_duration = 1;  // in microseconds
+  while (true) {
+    if (partition->messages_.Pop(&message)) {
+      if (message.release_) {
+        partition->lm_.ReleaseAll(message.txn_, message.locks_);
+      } else if (partition->lm_.AcquireAll(message.txn_, message.locks_, true)) {
+        partition->owner_->PartitionGranted(message.txn_);
+      }
 
+      // txns whose last lock here was just handed over by a release
+      while (!partition->ready_txns_.empty()) {
+        partition->owner_->PartitionGranted(partition->ready_txns_.front());
+        partition->ready_txns_.pop_front();
+      }
+      // Reset backoff.
+      sleep_duration = 1;
+    } else if (partition->owner_->stopped_) {
+      break;
+    } else {
+      usleep(sleep_duration);
+      // Back off exponentially.
+      if (sleep_duration < 32)
+        sleep_duration *= 2;
+    }
+  }
+  return NULL;
+}
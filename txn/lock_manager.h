@@ -9,29 +9,126 @@
 #include <tr1/unordered_map>
 #include <deque>
 #include <map>
+#include <set>
 #include <vector>
 #include <pthread.h>
 
 #include "txn/common.h"
+#include "utils/atomic.h"
+#include "utils/mutex.h"
 
 using std::map;
 using std::deque;
+using std::set;
 using std::vector;
 using std::tr1::unordered_map;
 
 class Txn;
 
 // This interface supports locks being held in both read/shared and
-// write/exclusive modes.
+// write/exclusive modes. LockManagerB also takes intention locks on key
+// ranges, above its per-key locks.
 enum LockMode {
   UNLOCKED = 0,
   SHARED = 1,
   EXCLUSIVE = 2,
+  INTENTION_SHARED = 3,     // Will lock keys in the range SHARED.
+  INTENTION_EXCLUSIVE = 4,  // Will lock keys in the range EXCLUSIVE.
+};
+
+// One entry of a txn's lock set: a key and the mode it is to be locked in.
+struct KeyLock {
+  KeyLock(const Key& k, LockMode m) : key_(k), mode_(m) {}
+  Key key_;
+  LockMode mode_;
+};
+
+// Sets '*locks' to the lock set of 'txn' sorted by key: SHARED for every key
+// only in its readset_, EXCLUSIVE for every key in its writeset_. Since both
+// sets are already ordered this is a single merge, with no sort.
+void SortedLocks(const Txn* txn, vector<KeyLock>* locks);
+
+// How LockManagerC resolves a lock request that conflicts with requests
+// already queued for the key. Wait-die and wound-wait compare unique_id_s, so
+// a txn restarted with its original id keeps its priority and never starves.
+enum DeadlockPolicy {
+  NO_WAIT = 0,     // Requester aborts on any conflict.
+  WAIT_DIE = 1,    // Older requester waits, younger requester aborts (dies).
+  WOUND_WAIT = 2,  // Older requester aborts (wounds) younger waiting txns and
+                   // waits; younger requester waits.
+};
+
+// Counters maintained by a lock manager's deadlock handling.
+struct DeadlockStats {
+  DeadlockStats()
+      : detector_runs_(0), deadlocks_(0), total_latency_(0), total_run_time_(0),
+        dies_(0), wounds_(0) {}
+
+  // Deadlock detection (LockManagerD).
+  int detector_runs_;      // Detection passes that found at least 2 waiters.
+  int deadlocks_;          // Cycles broken, i.e. victims aborted.
+  double total_latency_;   // Sum over victims of time waited before abort.
+  double total_run_time_;  // Time spent building and searching the graph.
+
+  // Deadlock prevention (TWOPL scheduler over LockManagerC).
+  int dies_;               // Requesters aborted by NO_WAIT or WAIT_DIE.
+  int wounds_;             // Waiting txns aborted by WOUND_WAIT.
+};
+
+// Contention counters for one key, as sampled by a LockProfiler.
+struct KeyContention {
+  KeyContention()
+      : key_(0), requests_(0), denials_(0), max_queue_depth_(0), waits_(0),
+        wait_time_(0) {}
+  Key key_;
+  uint64 requests_;      // Lock requests sampled.
+  uint64 denials_;       // Sampled requests not granted immediately.
+  int max_queue_depth_;  // Most requests queued at once, this one included.
+  uint64 waits_;         // Sampled denied requests that finished waiting.
+  double wait_time_;     // Total seconds those requests waited.
+};
+
+// Sampled lock contention statistics, kept per key by every lock manager so
+// that the records behind lock conflicts and aborts can be found. One in
+// every 'sample_rate' requests is profiled; a rate of 0 disables profiling.
+//
+// RecordRequest() and RecordWait() must be serialized by the owning lock
+// manager. The reporting methods may be called from any thread.
+class LockProfiler {
+ public:
+  explicit LockProfiler(int sample_rate);
+
+  void SetSampleRate(int sample_rate);
+
+  // Called for every lock request. Returns true if the request is sampled,
+  // in which case the caller reports how long it waited (if it was denied)
+  // with RecordWait().
+  bool RecordRequest(const Key& key, bool granted, int queue_depth);
+  void RecordWait(const Key& key, double seconds);
+
+  // Sets '*top' to the (up to) 'k' keys with the most denials, ties broken by
+  // total wait time, hottest first.
+  void TopKeys(int k, vector<KeyContention>* top);
+
+  // Sets '*buckets' to a histogram of sampled wait times: bucket 0 counts
+  // waits under 1us, and bucket i > 0 waits of [2^(i-1), 2^i) us. The last
+  // bucket also counts every longer wait.
+  void WaitHistogram(vector<uint64>* buckets);
+
+ private:
+  int sample_rate_;
+  uint64 requests_;  // All requests seen, sampled or not.
+
+  // Guards 'stats_' and 'histogram_' against concurrent reporting.
+  Mutex mutex_;
+  unordered_map<Key, KeyContention> stats_;
+  vector<uint64> histogram_;
 };
 
 class LockManager {
  public:
-  virtual ~LockManager() {}
+  LockManager();
+  virtual ~LockManager();
 
   // Attempts to grant a read lock to the specified transaction, enqueueing
   // request in lock table. Returns true if lock is immediately granted, else
@@ -70,7 +167,79 @@ class LockManager {
 
   virtual bool ReadyExecute(Txn *txn) = 0;
 
+  // Requests every lock in 'locks' (as built by SortedLocks) for 'txn' in one
+  // batch, returning true if all of them are granted immediately. Otherwise,
+  // if 'wait' is true the requests are left enqueued as if by ReadLock and
+  // WriteLock and 'txn' becomes ready once its last lock is granted; if
+  // 'wait' is false no request at all is left in the lock table.
+  //
+  // The default issues one ReadLock/WriteLock per key and cancels them on
+  // the first denial. Lock managers override it to check and enqueue the
+  // whole batch with one lock table latch acquisition.
+  //
+  // Requires: Neither ReadLock nor WriteLock has previously been called with
+  //           this txn and any of these keys.
+  virtual bool AcquireAll(Txn* txn, const vector<KeyLock>& locks, bool wait);
+
+  // Releases (or cancels) every lock in 'locks' held or requested by 'txn',
+  // as if by one Release() per key.
+  virtual void ReleaseAll(Txn* txn, const vector<KeyLock>& locks);
+
+  // Controlled lock violation. A txn that has finished executing and has
+  // installed its writes may release its locks with ReleaseEarly() before it
+  // commits. A txn later granted a lock on a key so released EXCLUSIVE may
+  // read the uncommitted writes, so it must not commit before the releaser.
+  //
+  // ReleaseEarly() releases 'locks' as ReleaseAll() does, and if 'txn'
+  // completed with a commit decision marks its EXCLUSIVE keys as violated
+  // until it commits.
+  void ReleaseEarly(Txn* txn, const vector<KeyLock>& locks);
+
+  // Makes 'txn', which has just been granted all of 'locks', depend on the
+  // uncommitted txn that last released each of them early, if any.
+  void AddCommitDependencies(Txn* txn, const vector<KeyLock>& locks);
+
+  // Returns true if 'txn', which has completed, still depends on an
+  // uncommitted txn. It then commits once its last dependency has (see
+  // Committed()).
+  bool CommitBlocked(Txn* txn);
+
+  // Records that 'txn' has committed (or aborted), and appends to '*ready'
+  // every completed txn that was waiting only on it.
+  void Committed(Txn* txn, vector<Txn*>* ready);
+
+  // Contention statistics for this lock manager's keys.
+  LockProfiler* Profiler() { return &profiler_; }
+
+  // Blocking variants of ReadLock/WriteLock for lock managers that are called
+  // directly from worker threads. The request is enqueued in the lock table
+  // and the calling thread is parked until a Release() hands it the lock.
+  // Returns true once the lock is granted, or false if the txn was chosen as
+  // a deadlock victim while waiting, in which case the request has already
+  // been removed and the caller must release its other locks and restart.
+  //
+  // Requires: Neither ReadLock nor WriteLock has previously been called with
+  //           this txn and key.
+  virtual bool ReadLockBlocking(Txn* txn, const Key& key) {
+    DIE("ReadLockBlocking is not supported by this lock manager.");
+  }
+  virtual bool WriteLockBlocking(Txn* txn, const Key& key) {
+    DIE("WriteLockBlocking is not supported by this lock manager.");
+  }
+
  protected:
+  // Parking spot for a thread blocked in ReadLockBlocking/WriteLockBlocking.
+  // Lives on the blocked thread's stack. The thread whose Release() grants the
+  // lock sets 'granted_' and signals 'cv_' while holding 'lock_table_lock_'.
+  // A deadlock detector instead removes the request and sets 'aborted_',
+  // also while holding 'lock_table_lock_', and signals 'cv_' the same way.
+  struct LockWaiter {
+    pthread_cond_t cv_;
+    bool granted_;
+    bool aborted_;
+    double wait_start_;  // When the thread was parked.
+  };
+
   // The LockManager's lock table tracks all lock requests. For a given key, if
   // 'lock_table_' contains a nonempty deque, then the item with that key is
   // locked and either:
@@ -98,9 +267,15 @@ class LockManager {
   // then Txn1 currently holds an EXCLUSIVE lock on "key1". When Txn1 releases
   // its lock, Txn2 and Txn3 will simultaneously acquire SHARED locks on "key1".
   struct LockRequest {
-    LockRequest(LockMode m, Txn* t) : txn_(t), mode_(m) {}
+    LockRequest(LockMode m, Txn* t, LockWaiter* w = NULL)
+        : txn_(t), mode_(m), waiter_(w) {}
     Txn* txn_;       // Pointer to txn requesting the lock.
     LockMode mode_;  // Specifies whether this is a read or write lock request.
+
+    // Thread parked on this request, or NULL if no thread is waiting on it
+    // (either the lock was granted immediately or the request came from the
+    // non-blocking interface).
+    LockWaiter* waiter_;
   };
   unordered_map<Key, deque<LockRequest>*> lock_table_;
 
@@ -114,6 +289,138 @@ class LockManager {
   // txn.
   unordered_map<Txn*, int> txn_waits_;
 
+  // Returns true if a 'mode' request appended to 'txnDeque' would be granted
+  // immediately, i.e. it is compatible with every request already queued.
+  static bool Compatible(const deque<LockRequest>& txnDeque, LockMode mode);
+
+  // Returns true if locks in modes 'held' and 'requested' may be held on the
+  // same item at once by different txns.
+  static bool Compatible(LockMode held, LockMode requested);
+
+  // LockManagerB and LockManagerC keep their requests in intrusive queues
+  // instead of 'lock_table_'. Each request is a LockNode linked both into the
+  // LockQueue of its key and into the TxnLocks chain of its txn, so once the
+  // node is found, unlinking it takes constant time, with no rehashing of the
+  // key and no scan of the queue. Release() finds the node by walking the
+  // txn's chain, and ReleaseAll() dequeues from the chain in a single pass.
+  struct LockQueue;
+  struct TxnLocks;
+  struct LockNode {
+    Txn* txn_;
+    Key key_;
+    LockMode mode_;
+    bool granted_;
+    LockQueue* queue_;    // Queue for 'key_'.
+    TxnLocks* owner_;     // Lock set of 'txn_'.
+    LockNode* prev_;      // Neighbours in 'queue_', in arrival order.
+    LockNode* next_;
+    LockNode* txn_prev_;  // Neighbours in the chain of 'owner_'.
+    LockNode* txn_next_;
+    double wait_start_;   // When a profiled request began waiting, else 0.
+
+    // Range locks (LockManagerB only). A range node's 'key_' is the range
+    // number, and 'keys_' counts the txn's keys it covers (SHARED or
+    // EXCLUSIVE) or announces (intention modes). A key node's 'parent_' is
+    // the intention lock it was taken under.
+    bool range_;
+    int keys_;
+    LockNode* parent_;
+  };
+
+  // Requests for one item in arrival order, with the same granting rule as
+  // 'lock_table_': the first 'holders_' requests hold the lock and every
+  // request from 'first_waiting_' on is still waiting.
+  struct LockQueue {
+    LockQueue()
+        : head_(NULL), tail_(NULL), first_waiting_(NULL), holders_(0), size_(0) {
+      for (int i = 0; i <= INTENTION_EXCLUSIVE; i++) {
+        held_[i] = 0;
+      }
+    }
+    LockNode* head_;
+    LockNode* tail_;
+    LockNode* first_waiting_;
+    int holders_;
+    int held_[INTENTION_EXCLUSIVE + 1];  // Holders in each LockMode.
+    int size_;
+  };
+
+  // All requests of one txn, and how many of them are still waiting.
+  struct TxnLocks {
+    TxnLocks() : locks_(NULL), waits_(0), keys_(0) {}
+    LockNode* locks_;
+    int waits_;
+    int keys_;  // Keys requested by the txn (LockManagerB only).
+  };
+
+  // Returns the queue for 'key', creating it if necessary.
+  LockQueue* QueueFor(const Key& key);
+
+  // Returns the lock set of 'txn', creating it if necessary.
+  TxnLocks* LocksOf(Txn* txn);
+
+  // Returns true if a 'mode' request appended to 'queue' would be granted
+  // immediately.
+  static bool Grantable(const LockQueue* queue, LockMode mode);
+
+  // Returns true if a 'mode' request is compatible with every current holder
+  // of 'queue', ignoring any waiting requests.
+  static bool CompatibleWithHolders(const LockQueue* queue, LockMode mode);
+
+  // Appends a 'mode' request by 'txn' to 'queue', granting it if possible and
+  // otherwise counting it as one more lock txn waits on. 'range' marks a
+  // range lock, for which 'key' is the range number.
+  LockNode* Enqueue(Txn* txn, TxnLocks* locks, LockQueue* queue,
+                    const Key& key, LockMode mode, bool range = false);
+
+  // Returns txn's (key-level) request for key, or NULL if there is none.
+  // Walks the txn's chain.
+  LockNode* FindNode(Txn* txn, const Key& key);
+
+  // Removes 'node', whether granted or still waiting, and grants every
+  // request that it was holding up. Txns left waiting on no lock are appended
+  // to 'ready_txns_' in queue order. Frees the txn's lock set once it holds
+  // no more requests.
+  void Dequeue(LockNode* node);
+
+  // Dequeues txn's request for every key in 'locks' that it has one for,
+  // walking its chain once.
+  //
+  // Requires: 'locks' is sorted by key, as built by SortedLocks.
+  void DequeueAll(Txn* txn, const vector<KeyLock>& locks);
+
+  // Grants the longest run of compatible requests starting at
+  // 'first_waiting_'.
+  void GrantWaiting(LockQueue* queue);
+
+  // Status() over the intrusive queues.
+  LockMode QueueStatus(const Key& key, vector<Txn*>* owners);
+
+  // Returns true if 'txn' is not waiting on any request in the intrusive
+  // queues.
+  bool QueueReady(Txn* txn);
+
+  unordered_map<Key, LockQueue*> lock_queues_;
+  unordered_map<Txn*, TxnLocks*> txn_locks_;
+
+  // Dequeued nodes, linked through 'next_', for reuse by Enqueue().
+  LockNode* free_nodes_;
+
+  LockProfiler profiler_;
+
+  // Commit dependencies of one txn under controlled lock violation.
+  struct CommitState {
+    CommitState() : waits_(0), completed_(false) {}
+    int waits_;               // Uncommitted txns it depends on.
+    bool completed_;          // Completed, and waiting for them to commit.
+    vector<Txn*> dependents_; // Txns depending on it.
+    vector<Key> violated_;    // Keys it released EXCLUSIVE before committing.
+  };
+  unordered_map<Txn*, CommitState> commit_states_;
+
+  // Last uncommitted txn to release an EXCLUSIVE lock on each key early.
+  unordered_map<Key, Txn*> violators_;
+
   // locks the whole lock table
   pthread_mutex_t lock_table_lock_; 
 };
@@ -132,22 +439,71 @@ class LockManagerA : public LockManager {
 };
 
 // Version of the LockManager implementing both shared and exclusive locks.
+//
+// Locks are multi-granularity: keys are grouped into fixed ranges, and every
+// key lock is taken under an INTENTION_SHARED or INTENTION_EXCLUSIVE lock on
+// its range. AcquireAll() escalates automatically: when a batch holds more
+// than a threshold of keys in one range, it takes a single SHARED or
+// EXCLUSIVE lock on the whole range instead of a lock per key. A txn holding
+// such a range lock takes no further locks on keys in the range.
+//
+// Denied requests stay queued and are granted strictly in queue order, so if
+// each txn requests all of its locks before the next txn requests any (as
+// the CALVIN scheduler does) no deadlock is possible.
 class LockManagerB : public LockManager {
  public:
   explicit LockManagerB(deque<Txn*>* ready_txns);
-  inline virtual ~LockManagerB() {}
+  virtual ~LockManagerB();
 
   virtual bool ReadLock(Txn* txn, const Key& key);
   virtual bool WriteLock(Txn* txn, const Key& key);
   virtual void Release(Txn* txn, const Key& key);
   virtual LockMode Status(const Key& key, vector<Txn*>* owners);
   virtual bool ReadyExecute(Txn *txn);
+  virtual bool AcquireAll(Txn* txn, const vector<KeyLock>& locks, bool wait);
+  virtual void ReleaseAll(Txn* txn, const vector<KeyLock>& locks);
+
+ private:
+  // Enqueues a 'mode' request, returning true if it is granted immediately.
+  bool Lock(Txn* txn, const Key& key, LockMode mode);
+
+  // Returns the queue for range 'range', creating it if necessary.
+  LockQueue* RangeQueueFor(uint64 range);
+
+  // Returns txn's lock on 'range' in exactly 'mode', or NULL if none.
+  LockNode* FindRangeNode(TxnLocks* locks, uint64 range, LockMode mode);
+
+  // Returns txn's SHARED or EXCLUSIVE lock on the range of 'key' if it covers
+  // a 'mode' lock on 'key', else NULL.
+  LockNode* CoveringRangeNode(TxnLocks* locks, const Key& key, LockMode mode);
+
+  // Requests a 'mode' lock on 'key' (under an intention lock on its range, or
+  // through a range lock the txn already holds). Returns true if the lock and
+  // the range lock it depends on are both granted.
+  bool LockKey(Txn* txn, TxnLocks* locks, const Key& key, LockMode mode);
+
+  // Requests a 'mode' lock on the whole of 'range' covering 'keys' of the
+  // txn's keys. Returns true if granted.
+  bool LockRange(Txn* txn, TxnLocks* locks, uint64 range, LockMode mode,
+                 int keys);
+
+  unordered_map<uint64, LockQueue*> range_queues_;
 };
 
 // Version of the LockManager implemented for final project - strict 2PL
+//
+// A conflicting request is always enqueued. ReadLock/WriteLock return true if
+// the lock was granted or the txn may wait for it under 'policy_', and false
+// if the txn must die, in which case the caller releases all of its requests
+// and restarts it. Under WOUND_WAIT an older requester instead wounds the
+// younger txns it conflicts with: those that are still waiting on locks are
+// handed back through TakeWoundedTxns() to be aborted, while those already
+// holding all of their locks are left to finish since they cannot be part of
+// a waits-for cycle.
 class LockManagerC : public LockManager {
  public:
-  explicit LockManagerC(deque<Txn*>* ready_txns);
+  explicit LockManagerC(deque<Txn*>* ready_txns,
+                        DeadlockPolicy policy = NO_WAIT);
   inline virtual ~LockManagerC() {}
 
   virtual bool ReadLock(Txn* txn, const Key& key);
@@ -155,13 +511,40 @@ class LockManagerC : public LockManager {
   virtual void Release(Txn* txn, const Key& key);
   virtual LockMode Status(const Key& key, vector<Txn*>* owners);
   virtual bool ReadyExecute(Txn *txn);
+  virtual void ReleaseAll(Txn* txn, const vector<KeyLock>& locks);
+
+  // Moves every wounded txn that is still waiting on a lock into '*wounded'.
+  // The caller must release all of their requests and restart them, except
+  // those that releasing an earlier one has made ready: those were granted
+  // their last lock, are already in 'ready_txns_', and must run instead.
+  void TakeWoundedTxns(vector<Txn*>* wounded);
+
+ private:
+  // Enqueues a 'mode' request and applies 'policy_' if it is not granted.
+  bool Lock(Txn* txn, const Key& key, LockMode mode);
+
+  DeadlockPolicy policy_;
+
+  // Txns wounded since the last call to TakeWoundedTxns().
+  set<Txn*> wounded_;
 };
 
 // Better version of the LockManager implemented for final project - strict 2PL
+//
+// Thread-safe: every method takes 'lock_table_lock_', so worker threads call
+// into it directly. ReadLock/WriteLock never enqueue a denied request, while
+// ReadLockBlocking/WriteLockBlocking enqueue it and park the caller until
+// Release() hands the lock over.
+//
+// Because a blocked worker holds on to its other locks, waits can form cycles
+// whenever txns acquire locks in different orders. StartDeadlockDetector()
+// starts a background thread that periodically builds the waits-for graph of
+// the parked requests and aborts the youngest txn (largest unique_id_) on
+// each cycle it finds.
 class LockManagerD : public LockManager {
  public:
   explicit LockManagerD(deque<Txn*>* ready_txns);
-  inline virtual ~LockManagerD() {}
+  virtual ~LockManagerD();
 
   virtual bool ReadLock(Txn* txn, const Key& key);
   virtual bool WriteLock(Txn* txn, const Key& key);
@@ -169,6 +552,148 @@ class LockManagerD : public LockManager {
   virtual LockMode Status(const Key& key, vector<Txn*>* owners);
   virtual bool ReadyExecute(Txn *txn);
 
+  virtual bool ReadLockBlocking(Txn* txn, const Key& key);
+  virtual bool WriteLockBlocking(Txn* txn, const Key& key);
+
+  // Only the non-blocking form ('wait' false) is supported: the whole batch
+  // is granted atomically or not at all.
+  virtual bool AcquireAll(Txn* txn, const vector<KeyLock>& locks, bool wait);
+  virtual void ReleaseAll(Txn* txn, const vector<KeyLock>& locks);
+
+  // Starts the background deadlock detector, running one detection pass
+  // every 'interval' seconds until the lock manager is destroyed.
+  void StartDeadlockDetector(double interval);
+
+  // Runs a single detection pass: aborts a victim on every waits-for cycle
+  // among the currently parked requests.
+  void DetectDeadlocks();
+
+  // Returns a snapshot of the deadlock detector's counters.
+  DeadlockStats GetDeadlockStats();
+
+ private:
+  // Enqueues a 'mode' request and waits until it is granted or the txn is
+  // aborted as a deadlock victim.
+  bool LockBlocking(Txn* txn, const Key& key, LockMode mode);
+
+  // Removes txn's request for key and wakes any requests it unblocks.
+  //
+  // Requires: 'lock_table_lock_' is held.
+  void ReleaseLocked(Txn* txn, const Key& key);
+
+  // Wakes every parked request in the granted prefix of 'txnDeque'.
+  //
+  // Requires: 'lock_table_lock_' is held.
+  void GrantWaiters(deque<LockRequest>* txnDeque);
+
+  // Adds to '*edges' every txn that 'txn', parked on 'key', waits for.
+  //
+  // Requires: 'lock_table_lock_' is held.
+  void WaitsFor(Txn* txn, const Key& key, set<Txn*>* edges);
+
+  // Removes the parked request of 'victim' and wakes it with 'aborted_' set.
+  //
+  // Requires: 'lock_table_lock_' is held.
+  void AbortWaiter(Txn* victim);
+
+  static void* RunDeadlockDetector(void* arg);
+
+  // Key each parked txn is currently waiting on. A txn blocks on at most one
+  // key at a time, so this gives every node of the waits-for graph.
+  unordered_map<Txn*, Key> waiting_on_;
+
+  // Background detector thread state.
+  pthread_t detector_;
+  bool detector_started_;
+  volatile bool detector_stopped_;
+  double detector_interval_;
+
+  // Guarded by 'lock_table_lock_'.
+  DeadlockStats deadlock_stats_;
+};
+
+// Lock manager for the CALVIN scheduler that spreads the lock table over
+// several lock threads. Keys are range-partitioned: each stripe of
+// consecutive keys belongs to one partition, and each partition is a
+// LockManagerB owned by exactly one thread, so partitions are never latched.
+//
+// Acquire() and Release() split a txn's lock set by partition and post one
+// message to the queue of each partition it touches. A txn becomes ready once
+// every one of those partitions has granted all of its locks there. Since a
+// single thread posts all Acquire() messages, every partition queues requests
+// in the same global order and, as for LockManagerB under CALVIN, no deadlock
+// is possible.
+class PartitionedLockManager {
+ public:
+  explicit PartitionedLockManager(int partitions);
+  ~PartitionedLockManager();
+
+  // Requests every lock in the readset and writeset of 'txn'.
+  //
+  // Requires: Called from a single thread, in txn sequence order.
+  void Acquire(Txn* txn);
+
+  // Releases every lock held by 'txn'.
+  //
+  // Requires: 'txn' has been returned by NextReady(), and this is called
+  //           from the thread that calls Acquire().
+  void Release(Txn* txn);
+
+  // If some txn has acquired all of its locks since the last call, sets
+  // '*txn' to it and returns true, else returns false.
+  bool NextReady(Txn** txn);
+
+ private:
+  // A batch of lock requests or releases for one partition.
+  struct LockMessage {
+    Txn* txn_;
+    bool release_;
+    vector<KeyLock> locks_;
+  };
+
+  // State owned by a single lock thread.
+  struct Partition {
+    Partition(PartitionedLockManager* owner)
+        : owner_(owner), lm_(&ready_txns_) {}
+    PartitionedLockManager* owner_;
+    deque<Txn*> ready_txns_;  // Txns granted everything in this partition.
+    LockManagerB lm_;
+    AtomicQueue<LockMessage> messages_;
+    pthread_t thread_;
+  };
+
+  // Returns the partition owning 'key'.
+  int PartitionOf(const Key& key) const;
+
+  // Splits the lock set of 'txn' by partition into 'split_', returning the
+  // number of partitions it touches.
+  int Split(Txn* txn);
+
+  // Posts each nonempty share in 'split_' to its partition, leaving 'split_'
+  // empty.
+  void Post(Txn* txn, bool release);
+
+  // Records that one of txn's partitions has granted all of its locks there,
+  // and makes txn ready if it was the last.
+  void PartitionGranted(Txn* txn);
+
+  static void* RunPartition(void* arg);
+
+  vector<Partition*> partitions_;
+  volatile bool stopped_;
+
+  // Number of partitions that have yet to grant each txn all of its locks.
+  // Set by Acquire() before any partition can see the txn.
+  Mutex pending_mutex_;
+  unordered_map<Txn*, int> pending_partitions_;
+
+  // Txns that have acquired all of their locks.
+  AtomicQueue<Txn*> ready_;
+
+  // Scratch space for Split(), which is only called by the posting thread.
+  vector<KeyLock> locks_;
+  vector<vector<KeyLock> > split_;
 };
+
 #endif  // _LOCK_MANAGER_H_
 
@@ -3,9 +3,12 @@
 
 #include "txn/lock_manager.h"
 
+#include <pthread.h>
 #include <set>
 #include <string>
+#include <unistd.h>
 
+#include "txn/txn_types.h"
 #include "utils/testing.h"
 
 using std::set;
@@ -187,10 +190,513 @@ TEST(LockManagerB_LocksReleasedOutOfOrder) {
   END;
 }
 
+TEST(LockManagerB_AcquireAll) {
+  deque<Txn*> ready_txns;
+  LockManagerB lm(&ready_txns);
+  vector<Txn*> owners;
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  Txn* t2 = reinterpret_cast<Txn*>(2);
+  Txn* t3 = reinterpret_cast<Txn*>(3);
+
+  vector<KeyLock> locks1;
+  locks1.push_back(KeyLock(101, SHARED));
+  locks1.push_back(KeyLock(102, EXCLUSIVE));
+  vector<KeyLock> locks2;
+  locks2.push_back(KeyLock(101, SHARED));
+  locks2.push_back(KeyLock(102, SHARED));
+  locks2.push_back(KeyLock(103, EXCLUSIVE));
+
+  // Txn 1 acquires its whole batch.
+  EXPECT_TRUE(lm.AcquireAll(t1, locks1, false));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(102, &owners));
+  EXPECT_EQ(t1, owners[0]);
+
+  // Txn 2 conflicts on 102 and, without waiting, gets nothing at all.
+  EXPECT_FALSE(lm.AcquireAll(t2, locks2, false));
+  EXPECT_EQ(SHARED, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(UNLOCKED, lm.Status(103, &owners));
+
+  // Txn 3 waits instead, and is ready once Txn 1 releases its batch.
+  EXPECT_FALSE(lm.AcquireAll(t3, locks2, true));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(103, &owners));
+  EXPECT_EQ(t3, owners[0]);
+  EXPECT_FALSE(lm.ReadyExecute(t3));
+  lm.ReleaseAll(t1, locks1);
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t3, ready_txns.at(0));
+
+  END;
+}
+
+TEST(LockManagerB_Escalation) {
+  deque<Txn*> ready_txns;
+  LockManagerB lm(&ready_txns);
+  vector<Txn*> owners;
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  Txn* t2 = reinterpret_cast<Txn*>(2);
+  Txn* t3 = reinterpret_cast<Txn*>(3);
+
+  vector<KeyLock> locks1;
+  for (Key key = 0; key < 100; key++) {
+    locks1.push_back(KeyLock(key, EXCLUSIVE));
+  }
+
+  // Txn 1's batch is large enough to lock its whole range.
+  EXPECT_TRUE(lm.AcquireAll(t1, locks1, true));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(5, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+
+  // Keys outside the batch but in the same range are locked too; keys in
+  // other ranges are not.
+  EXPECT_FALSE(lm.WriteLock(t2, 200));
+  EXPECT_TRUE(lm.WriteLock(t3, 5000));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(5000, &owners));
+  EXPECT_EQ(t3, owners[0]);
+
+  lm.ReleaseAll(t1, locks1);
+  EXPECT_EQ(UNLOCKED, lm.Status(5, &owners));
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t2, ready_txns.at(0));
+
+  // Small batches still lock only their own keys.
+  lm.Release(t2, 200);
+  EXPECT_TRUE(lm.ReadLock(t1, 5));
+  EXPECT_TRUE(lm.ReadLock(t2, 5));
+  EXPECT_TRUE(lm.WriteLock(t2, 6));
+  EXPECT_EQ(SHARED, lm.Status(5, &owners));
+  EXPECT_EQ(2, owners.size());
+
+  END;
+}
+
+TEST(LockManagerB_EarlyRelease) {
+  deque<Txn*> ready_txns;
+  LockManagerB lm(&ready_txns);
+  vector<Txn*> ready;
+
+  Txn* t1 = new Noop();
+  Txn* t2 = new Noop();
+  Txn* t3 = new Noop();
+
+  vector<KeyLock> locks1;
+  locks1.push_back(KeyLock(101, EXCLUSIVE));
+  vector<KeyLock> locks2;
+  locks2.push_back(KeyLock(101, SHARED));
+  locks2.push_back(KeyLock(102, EXCLUSIVE));
+  vector<KeyLock> locks3;
+  locks3.push_back(KeyLock(102, SHARED));
+
+  // Txn 2 waits on Txn 1 for 101, and Txn 3 on Txn 2 for 102.
+  EXPECT_TRUE(lm.AcquireAll(t1, locks1, true));
+  EXPECT_FALSE(lm.AcquireAll(t2, locks2, true));
+  EXPECT_FALSE(lm.AcquireAll(t3, locks3, true));
+
+  // Txn 1 completes and releases its lock before committing, so Txn 2 runs
+  // and comes to depend on it.
+  t1->Run();
+  lm.ReleaseEarly(t1, locks1);
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t2, ready_txns.at(0));
+  lm.AddCommitDependencies(t2, locks2);
+
+  // So does Txn 3 on Txn 2.
+  t2->Run();
+  lm.ReleaseEarly(t2, locks2);
+  EXPECT_EQ(2, ready_txns.size());
+  EXPECT_EQ(t3, ready_txns.at(1));
+  lm.AddCommitDependencies(t3, locks3);
+
+  // Txns 3 and 2 complete first but commit only behind Txn 1, in order.
+  t3->Run();
+  lm.ReleaseEarly(t3, locks3);
+  EXPECT_TRUE(lm.CommitBlocked(t3));
+  EXPECT_TRUE(lm.CommitBlocked(t2));
+  EXPECT_FALSE(lm.CommitBlocked(t1));
+  lm.Committed(t1, &ready);
+  EXPECT_EQ(1, ready.size());
+  EXPECT_EQ(t2, ready.at(0));
+  lm.Committed(t2, &ready);
+  EXPECT_EQ(2, ready.size());
+  EXPECT_EQ(t3, ready.at(1));
+  lm.Committed(t3, &ready);
+  EXPECT_EQ(2, ready.size());
+
+  // Once committed, Txn 1 has no dependents left.
+  Txn* t4 = new Noop();
+  EXPECT_TRUE(lm.AcquireAll(t4, locks1, true));
+  lm.AddCommitDependencies(t4, locks1);
+  t4->Run();
+  EXPECT_FALSE(lm.CommitBlocked(t4));
+  lm.ReleaseAll(t4, locks1);
+
+  delete t1;
+  delete t2;
+  delete t3;
+  delete t4;
+
+  END;
+}
+
+TEST(LockManagerC_WaitDie) {
+  deque<Txn*> ready_txns;
+  LockManagerC lm(&ready_txns, WAIT_DIE);
+
+  Txn* t1 = new Noop();
+  Txn* t2 = new Noop();
+  t1->unique_id_ = 1;
+  t2->unique_id_ = 2;
+
+  // Txn 1 holds 101 and Txn 2 holds 102.
+  EXPECT_TRUE(lm.WriteLock(t1, 101));
+  EXPECT_TRUE(lm.WriteLock(t2, 102));
+
+  // Younger Txn 2 dies on 101.
+  EXPECT_FALSE(lm.WriteLock(t2, 101));
+  lm.Release(t2, 101);
+
+  // Older Txn 1 waits on 102, and is ready once Txn 2 releases it.
+  EXPECT_TRUE(lm.WriteLock(t1, 102));
+  EXPECT_FALSE(lm.ReadyExecute(t1));
+  lm.Release(t2, 102);
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t1, ready_txns.at(0));
+
+  delete t1;
+  delete t2;
+
+  END;
+}
+
+TEST(LockManagerC_WoundWait) {
+  deque<Txn*> ready_txns;
+  LockManagerC lm(&ready_txns, WOUND_WAIT);
+  vector<Txn*> wounded;
+
+  Txn* t1 = new Noop();
+  Txn* t2 = new Noop();
+  Txn* t3 = new Noop();
+  t1->unique_id_ = 1;
+  t2->unique_id_ = 2;
+  t3->unique_id_ = 3;
+
+  // Txn 2 holds 101 and Txn 3 holds 102.
+  EXPECT_TRUE(lm.WriteLock(t2, 101));
+  EXPECT_TRUE(lm.WriteLock(t3, 102));
+
+  // Txn 2 waits on 102. Txn 3 is wounded but holds all of its locks, so it
+  // is left to finish.
+  EXPECT_TRUE(lm.WriteLock(t2, 102));
+  lm.TakeWoundedTxns(&wounded);
+  EXPECT_EQ(0, wounded.size());
+
+  // Older Txn 1 waits on 101 and wounds Txn 2, which is still waiting.
+  EXPECT_TRUE(lm.WriteLock(t1, 101));
+  lm.TakeWoundedTxns(&wounded);
+  EXPECT_EQ(1, wounded.size());
+  EXPECT_EQ(t2, wounded[0]);
+
+  // Aborting Txn 2 hands 101 to Txn 1.
+  lm.Release(t2, 101);
+  lm.Release(t2, 102);
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t1, ready_txns.at(0));
+
+  delete t1;
+  delete t2;
+  delete t3;
+
+  END;
+}
+
+TEST(LockManagerC_WoundChain) {
+  deque<Txn*> ready_txns;
+  LockManagerC lm(&ready_txns, WOUND_WAIT);
+  vector<Txn*> wounded;
+
+  Txn* t = new Noop();
+  Txn* o = new Noop();
+  Txn* v1 = new Noop();
+  Txn* v2 = new Noop();
+  t->unique_id_ = 1;
+  o->unique_id_ = 2;
+  v1->unique_id_ = 3;
+  v2->unique_id_ = 4;
+
+  // O holds 101, V1 holds 102 and waits on 101, V2 holds 103 and waits on
+  // 102.
+  EXPECT_TRUE(lm.WriteLock(o, 101));
+  EXPECT_TRUE(lm.WriteLock(v1, 102));
+  EXPECT_TRUE(lm.WriteLock(v2, 103));
+  EXPECT_TRUE(lm.WriteLock(v1, 101));
+  EXPECT_TRUE(lm.WriteLock(v2, 102));
+  lm.TakeWoundedTxns(&wounded);
+  EXPECT_EQ(0, wounded.size());
+
+  // Older T waits on 102 and 103, and wounds both V1 and V2.
+  EXPECT_TRUE(lm.WriteLock(t, 102));
+  EXPECT_TRUE(lm.WriteLock(t, 103));
+  lm.TakeWoundedTxns(&wounded);
+  EXPECT_EQ(2, wounded.size());
+
+  // Aborting V1 hands 102 to V2, which then holds all of its locks and is
+  // ready: it must not be aborted as well.
+  lm.Release(v1, 101);
+  lm.Release(v1, 102);
+  EXPECT_TRUE(lm.ReadyExecute(v2));
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(v2, ready_txns.at(0));
+
+  // Once V2 finishes, T gets both of its locks.
+  lm.Release(v2, 102);
+  lm.Release(v2, 103);
+  EXPECT_EQ(2, ready_txns.size());
+  EXPECT_EQ(t, ready_txns.at(1));
+
+  delete t;
+  delete o;
+  delete v1;
+  delete v2;
+
+  END;
+}
+
+TEST(LockManagerC_ReleaseAll) {
+  deque<Txn*> ready_txns;
+  LockManagerC lm(&ready_txns, WAIT_DIE);
+  vector<Txn*> owners;
+
+  Txn* t1 = new Noop();
+  Txn* t2 = new Noop();
+  t1->unique_id_ = 2;
+  t2->unique_id_ = 1;
+
+  // Txn 1 holds 101 to 103, and the older Txn 2 waits on 102.
+  EXPECT_TRUE(lm.WriteLock(t1, 101));
+  EXPECT_TRUE(lm.ReadLock(t1, 102));
+  EXPECT_TRUE(lm.WriteLock(t1, 103));
+  EXPECT_TRUE(lm.WriteLock(t2, 102));
+  EXPECT_FALSE(lm.ReadyExecute(t2));
+
+  // Releasing part of the batch leaves the rest held.
+  vector<KeyLock> some;
+  some.push_back(KeyLock(101, EXCLUSIVE));
+  some.push_back(KeyLock(103, EXCLUSIVE));
+  lm.ReleaseAll(t1, some);
+  EXPECT_EQ(UNLOCKED, lm.Status(101, &owners));
+  EXPECT_EQ(SHARED, lm.Status(102, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(103, &owners));
+  EXPECT_EQ(0, ready_txns.size());
+
+  vector<KeyLock> rest;
+  rest.push_back(KeyLock(102, SHARED));
+  lm.ReleaseAll(t1, rest);
+  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(t2, ready_txns.at(0));
+
+  delete t1;
+  delete t2;
+
+  END;
+}
+
+// Arguments for a thread issuing a blocking write lock request.
+struct BlockingRequest {
+  LockManager* lm_;
+  Txn* txn_;
+  Key key_;
+  bool done_;
+  bool granted_;
+};
+
+static void* RunBlockingWriteLock(void* arg) {
+  BlockingRequest* request = reinterpret_cast<BlockingRequest*>(arg);
+  request->granted_ = request->lm_->WriteLockBlocking(request->txn_, request->key_);
+  request->done_ = true;
+  return NULL;
+}
+
+TEST(LockManagerD_BlockingHandoff) {
+  deque<Txn*> ready_txns;
+  LockManagerD lm(&ready_txns);
+  vector<Txn*> owners;
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  Txn* t2 = reinterpret_cast<Txn*>(2);
+
+  // Txn 1 acquires write lock without blocking.
+  EXPECT_TRUE(lm.WriteLock(t1, 101));
+
+  // Txn 2 parks on a blocking write lock request.
+  BlockingRequest request = {&lm, t2, 101, false, false};
+  pthread_t thread;
+  pthread_create(&thread, NULL, RunBlockingWriteLock, &request);
+  Sleep(0.05);
+  EXPECT_FALSE(request.done_);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+
+  // Txn 1 releases lock. Txn 2 is handed the lock and wakes up.
+  lm.Release(t1, 101);
+  pthread_join(thread, NULL);
+  EXPECT_TRUE(request.done_);
+  EXPECT_TRUE(request.granted_);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t2, owners[0]);
+
+  lm.Release(t2, 101);
+  EXPECT_EQ(UNLOCKED, lm.Status(101, &owners));
+
+  END;
+}
+
+TEST(LockManagerD_DeadlockDetection) {
+  deque<Txn*> ready_txns;
+  LockManagerD lm(&ready_txns);
+  vector<Txn*> owners;
+
+  Txn* t1 = new Noop();
+  Txn* t2 = new Noop();
+  t1->unique_id_ = 1;
+  t2->unique_id_ = 2;
+
+  // Txn 1 holds 101 and Txn 2 holds 102.
+  EXPECT_TRUE(lm.WriteLock(t1, 101));
+  EXPECT_TRUE(lm.WriteLock(t2, 102));
+
+  // Each parks on the other's lock.
+  BlockingRequest request1 = {&lm, t1, 102, false, false};
+  BlockingRequest request2 = {&lm, t2, 101, false, false};
+  pthread_t thread1, thread2;
+  pthread_create(&thread1, NULL, RunBlockingWriteLock, &request1);
+  pthread_create(&thread2, NULL, RunBlockingWriteLock, &request2);
+  Sleep(0.05);
+  EXPECT_FALSE(request1.done_);
+  EXPECT_FALSE(request2.done_);
+
+  // The detector aborts Txn 2, the younger txn on the cycle.
+  lm.StartDeadlockDetector(0.001);
+  pthread_join(thread2, NULL);
+  EXPECT_TRUE(request2.done_);
+  EXPECT_FALSE(request2.granted_);
+  EXPECT_EQ(1, lm.GetDeadlockStats().deadlocks_);
+
+  // Txn 2 releases its lock and Txn 1 is handed 102.
+  lm.Release(t2, 102);
+  pthread_join(thread1, NULL);
+  EXPECT_TRUE(request1.granted_);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(102, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+
+  delete t1;
+  delete t2;
+
+  END;
+}
+
+TEST(LockProfiler_Contention) {
+  deque<Txn*> ready_txns;
+  LockManagerB lm(&ready_txns);
+  lm.Profiler()->SetSampleRate(1);
+
+  Txn* t1 = reinterpret_cast<Txn*>(1);
+  Txn* t2 = reinterpret_cast<Txn*>(2);
+  Txn* t3 = reinterpret_cast<Txn*>(3);
+
+  // Key 101 is contended, key 102 is not.
+  lm.WriteLock(t1, 101);
+  lm.WriteLock(t2, 101);
+  lm.ReadLock(t3, 101);
+  lm.ReadLock(t1, 102);
+  lm.Release(t1, 101);
+  lm.Release(t2, 101);
+
+  vector<KeyContention> top;
+  lm.Profiler()->TopKeys(1, &top);
+  EXPECT_EQ(1, top.size());
+  EXPECT_EQ(101, top[0].key_);
+  EXPECT_EQ(3, top[0].requests_);
+  EXPECT_EQ(2, top[0].denials_);
+  EXPECT_EQ(3, top[0].max_queue_depth_);
+  EXPECT_EQ(2, top[0].waits_);
+
+  vector<uint64> histogram;
+  lm.Profiler()->WaitHistogram(&histogram);
+  uint64 waits = 0;
+  for (uint32 i = 0; i < histogram.size(); i++)
+    waits += histogram[i];
+  EXPECT_EQ(2, waits);
+
+  END;
+}
+
+// Waits up to a second for the next ready txn, returning NULL if none.
+Txn* WaitReady(PartitionedLockManager* lm) {
+  Txn* txn;
+  for (int i = 0; i < 1000; i++) {
+    if (lm->NextReady(&txn)) {
+      return txn;
+    }
+    usleep(1000);
+  }
+  return NULL;
+}
+
+TEST(PartitionedLockManager_MultiPartition) {
+  // With two partitions, keys 0-15 and 32-47 belong to partition 0 and keys
+  // 16-31 to partition 1.
+  PartitionedLockManager lm(2);
+  Txn* txn;
+
+  set<Key> writeset1;
+  writeset1.insert(1);
+  writeset1.insert(16);
+  set<Key> readset2;
+  readset2.insert(16);
+  set<Key> writeset2;
+  writeset2.insert(40);
+  Txn* t1 = new RMW(writeset1);
+  Txn* t2 = new RMW(readset2, writeset2);
+
+  // Txn 1 is granted both of its partitions. Txn 2 is granted partition 0
+  // but waits for Txn 1 in partition 1.
+  lm.Acquire(t1);
+  lm.Acquire(t2);
+  EXPECT_EQ(t1, WaitReady(&lm));
+  usleep(10000);
+  EXPECT_FALSE(lm.NextReady(&txn));
+
+  lm.Release(t1);
+  EXPECT_EQ(t2, WaitReady(&lm));
+  lm.Release(t2);
+
+  delete t1;
+  delete t2;
+
+  END;
+}
+
 int main(int argc, char** argv) {
   LockManagerA_SimpleLocking();
   LockManagerA_LocksReleasedOutOfOrder();
   LockManagerB_SimpleLocking();
   LockManagerB_LocksReleasedOutOfOrder();
+  LockManagerB_AcquireAll();
+  LockManagerB_Escalation();
+  LockManagerB_EarlyRelease();
+  LockManagerC_WaitDie();
+  LockManagerC_WoundWait();
+  LockManagerC_WoundChain();
+  LockManagerC_ReleaseAll();
+  LockManagerD_BlockingHandoff();
+  LockManagerD_DeadlockDetection();
+  PartitionedLockManager_MultiPartition();
+  LockProfiler_Contention();
 }
 
@@ -0,0 +1,144 @@
+// Stored procedures: registered txn logic, called with a parameter block.
+
+#include "txn/procedure.h"
+
+void ProcedureParams::AddRead(const Key& key) {
+  if (reads_ + writes_ == PROCEDURE_MAX_KEYS)
+    DIE("Too many keys for a stored procedure call.");
+  if (writes_ > 0)
+    DIE("Stored procedure read added after its writes.");
+  keys_[reads_++] = key;
+}
+
+void ProcedureParams::AddWrite(const Key& key) {
+  if (reads_ + writes_ == PROCEDURE_MAX_KEYS)
+    DIE("Too many keys for a stored procedure call.");
+  keys_[reads_ + writes_++] = key;
+}
+
+ProcedureTxn* ProcedureTxn::clone() const {
+  ProcedureTxn* clone = new ProcedureTxn();
+  clone->logic_ = logic_;
+  clone->params_ = params_;
+  this->CopyTxnInternals(clone);
+  return clone;
+}
+
+void ProcedureTxn::Run() {
+  logic_(this, params_);
+}
+
+void ProcedureTxn::Bind(ProcedureLogic logic, const ProcedureParams& params) {
+  logic_ = logic;
+  params_ = params;
+
+  // keys are usually passed in order, so most inserts land at the end
+  readset_.clear();
+  writeset_.clear();
+  for (int i = 0; i < params.reads_; i++) {
+    readset_.insert(readset_.end(), params.keys_[i]);
+  }
+  for (int i = params.reads_; i < params.reads_ + params.writes_; i++) {
+    writeset_.insert(writeset_.end(), params.keys_[i]);
+  }
+
+  reads_.clear();
+  writes_.clear();
+  data_type_ = 1;
+  status_ = INCOMPLETE;
+  retries_ = 0;
+}
+
+ProcedureRegistry::ProcedureRegistry() {
+  Register("noop", &NoopProcedure);
+  Register("put", &PutProcedure);
+  Register("expect", &ExpectProcedure);
+  Register("rmw", &RmwProcedure);
+}
+
+ProcedureRegistry::~ProcedureRegistry() {
+  ProcedureTxn* txn;
+  while (free_.Pop(&txn)) {
+    delete txn;
+  }
+}
+
+int ProcedureRegistry::Register(const string& name, ProcedureLogic logic) {
+  mutex_.Lock();
+  names_.push_back(name);
+  logic_.push_back(logic);
+  int id = logic_.size() - 1;
+  mutex_.Unlock();
+  return id;
+}
+
+int ProcedureRegistry::Lookup(const string& name) {
+  int id = -1;
+  mutex_.Lock();
+  for (int i = 0; id < 0 and i < static_cast<int>(names_.size()); i++) {
+    if (names_[i] == name) {
+      id = i;
+    }
+  }
+  mutex_.Unlock();
+  return id;
+}
+
+Txn* ProcedureRegistry::NewTxn(int id, const ProcedureParams& params) {
+  mutex_.Lock();
+  if (id < 0 or id >= static_cast<int>(logic_.size()))
+    DIE("Unknown stored procedure " << id << ".");
+  ProcedureLogic logic = logic_[id];
+  mutex_.Unlock();
+
+  ProcedureTxn* txn;
+  if (!free_.Pop(&txn)) {
+    txn = new ProcedureTxn();
+  }
+  txn->Bind(logic, params);
+  return txn;
+}
+
+void ProcedureRegistry::Recycle(Txn* txn) {
+  free_.Push(static_cast<ProcedureTxn*>(txn));
+}
+
+void NoopProcedure(ProcedureTxn* txn, const ProcedureParams& params) {
+  txn->Commit();
+}
+
+void PutProcedure(ProcedureTxn* txn, const ProcedureParams& params) {
+  for (int i = params.reads_; i < params.reads_ + params.writes_; i++) {
+    txn->Write(params.keys_[i], params.value_);
+  }
+  txn->Commit();
+}
+
+void ExpectProcedure(ProcedureTxn* txn, const ProcedureParams& params) {
+  Value result;
+  for (int i = 0; i < params.reads_; i++) {
+    if (!txn->Read(params.keys_[i], &result) || result != params.value_) {
+      txn->Abort();
+      return;
+    }
+  }
+  txn->Commit();
+}
+
+void RmwProcedure(ProcedureTxn* txn, const ProcedureParams& params) {
+  Value result;
+  for (int i = 0; i < params.reads_; i++) {
+    txn->Read(params.keys_[i], &result);
+  }
+  for (int i = params.reads_; i < params.reads_ + params.writes_; i++) {
+    result = 0;
+    txn->Read(params.keys_[i], &result);
+    txn->Write(params.keys_[i], result + 1);
+  }
+
+  // simulate the txn logic taking time_, as RMW does
+  double begin = GetTime();
+  while (GetTime() - begin < params.time_) {
+  }
+  txn->Commit();
+}
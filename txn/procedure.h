@@ -0,0 +1,120 @@
+// Stored procedures: registered txn logic, called with a parameter block.
+
+#ifndef _PROCEDURE_H_
+#define _PROCEDURE_H_
+
+#include <string>
+#include <vector>
+
+#include "txn/common.h"
+#include "txn/txn.h"
+#include "utils/atomic.h"
+#include "utils/mutex.h"
+
+using std::string;
+using std::vector;
+
+// Most keys a call of a stored procedure may read and write in all.
+#define PROCEDURE_MAX_KEYS 32
+
+// Parameters of one stored procedure call, in a fixed-size block: the keys
+// the call reads followed by the keys it writes, and its scalar arguments.
+struct ProcedureParams {
+  ProcedureParams() : reads_(0), writes_(0), value_(0), time_(0) {}
+
+  // Appends 'key' to the keys read, or to the keys written. All reads must
+  // be added before the first write.
+  void AddRead(const Key& key);
+  void AddWrite(const Key& key);
+
+  int reads_;
+  int writes_;
+  Key keys_[PROCEDURE_MAX_KEYS];
+  Value value_;  // Value argument, such as the value a put writes.
+  double time_;  // Seconds of simulated txn logic, as for RMW.
+};
+
+class ProcedureTxn;
+
+// Logic of a stored procedure. Reads and writes go through 'txn', and it
+// finishes with txn->Commit() or txn->Abort().
+typedef void (*ProcedureLogic)(ProcedureTxn* txn, const ProcedureParams& params);
+
+// Txn running a stored procedure. Its logic is a plain function of the
+// registry rather than a Txn subclass of its own, and the txn itself is a
+// pooled context, reset and reused for call after call.
+//
+// Pooling saves only the txn's own allocation and clone(). Each call still
+// rebuilds readset_, writeset_ and the read/write maps, which allocate, and
+// the processor still reaches the logic through the virtual Run(), since
+// every mode handles the context as any other Txn.
+class ProcedureTxn : public Txn {
+ public:
+  ProcedureTxn() : logic_(NULL) {}
+
+  ProcedureTxn* clone() const;
+  virtual void Run();
+
+  // The txn's Read(), Write(), COMMIT and ABORT, for procedure logic.
+  bool Read(const Key& key, Value* value) { return Txn::Read(key, value); }
+  void Write(const Key& key, const Value& value) { Txn::Write(key, value); }
+  void Commit() { status_ = COMPLETED_C; }
+  void Abort() { status_ = COMPLETED_A; }
+
+ private:
+  friend class ProcedureRegistry;
+
+  // Resets the txn to an unsubmitted call of 'logic' with 'params'.
+  void Bind(ProcedureLogic logic, const ProcedureParams& params);
+
+  ProcedureLogic logic_;
+  ProcedureParams params_;
+};
+
+// Registry of named stored procedures, with a pool of the contexts calls to
+// them run in. A client looks up a procedure's id once, then for each call
+// takes a context with NewTxn() and submits it as any other txn. Once it has
+// the result back it hands the context to Recycle() instead of deleting it.
+//
+// May be used by several client threads at once.
+class ProcedureRegistry {
+ public:
+  // Registers the procedures below: "noop", "put", "expect" and "rmw".
+  ProcedureRegistry();
+
+  // Deletes the pooled contexts. Contexts still out are not the registry's.
+  ~ProcedureRegistry();
+
+  // Registers 'logic' as procedure 'name', and returns its id.
+  int Register(const string& name, ProcedureLogic logic);
+
+  // Returns the id of procedure 'name', or -1 if there is none.
+  int Lookup(const string& name);
+
+  // Returns a context running a call of procedure 'id' with 'params'. The
+  // caller owns it until it hands it to Recycle().
+  Txn* NewTxn(int id, const ProcedureParams& params);
+
+  // Returns a context taken from NewTxn() to the pool.
+  void Recycle(Txn* txn);
+
+ private:
+  // Procedures by id, guarded by 'mutex_'.
+  vector<string> names_;
+  vector<ProcedureLogic> logic_;
+  Mutex mutex_;
+
+  // Contexts ready for reuse.
+  AtomicQueue<ProcedureTxn*> free_;
+};
+
+// Built-in procedures, named as they are registered. "noop" commits. "put"
+// writes value_ to every key written. "expect" commits if every key read
+// holds value_, else aborts. "rmw" increments every key written, after
+// reading every key read, taking time_ seconds.
+void NoopProcedure(ProcedureTxn* txn, const ProcedureParams& params);
+void PutProcedure(ProcedureTxn* txn, const ProcedureParams& params);
+void ExpectProcedure(ProcedureTxn* txn, const ProcedureParams& params);
+void RmwProcedure(ProcedureTxn* txn, const ProcedureParams& params);
+
+#endif  // _PROCEDURE_H_
@@ -0,0 +1,77 @@
+// Tests for stored procedures.
+
+#include "txn/procedure.h"
+
+#include "txn/txn_processor.h"
+#include "utils/testing.h"
+
+TEST(ProcedureRegistry_Lookup) {
+  ProcedureRegistry registry;
+  EXPECT_EQ(0, registry.Lookup("noop"));
+  EXPECT_EQ(3, registry.Lookup("rmw"));
+  EXPECT_EQ(-1, registry.Lookup("missing"));
+
+  int id = registry.Register("missing", &NoopProcedure);
+  EXPECT_EQ(4, id);
+  EXPECT_EQ(id, registry.Lookup("missing"));
+
+  END;
+}
+
+TEST(ProcedureRegistry_Pooling) {
+  ProcedureRegistry registry;
+  ProcedureParams params;
+  params.AddRead(1);
+  params.AddWrite(2);
+  params.AddWrite(3);
+
+  // A recycled context is handed out again, bound to the new call.
+  Txn* first = registry.NewTxn(registry.Lookup("rmw"), params);
+  first->Run();
+  EXPECT_EQ(COMPLETED_C, first->Status());
+  registry.Recycle(first);
+
+  Txn* second = registry.NewTxn(registry.Lookup("noop"), ProcedureParams());
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(INCOMPLETE, second->Status());
+  registry.Recycle(second);
+
+  END;
+}
+
+TEST(ProcedureRegistry_Processor) {
+  TxnProcessor p(SERIAL);
+  ProcedureRegistry registry;
+  ProcedureParams params;
+  params.AddWrite(1);
+  params.value_ = 2;
+
+  // Calls run in submission order, each in a recycled context.
+  Txn* txn;
+  p.NewProcedureRequest(&registry, registry.Lookup("put"), params);
+  txn = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  registry.Recycle(txn);
+
+  ProcedureParams expect;
+  expect.AddRead(1);
+  expect.value_ = 1;
+  p.NewProcedureRequest(&registry, registry.Lookup("expect"), expect);
+  txn = p.GetTxnResult();
+  EXPECT_EQ(ABORTED, txn->Status());
+  registry.Recycle(txn);
+
+  expect.value_ = 2;
+  p.NewProcedureRequest(&registry, registry.Lookup("expect"), expect);
+  txn = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  registry.Recycle(txn);
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  ProcedureRegistry_Lookup();
+  ProcedureRegistry_Pooling();
+  ProcedureRegistry_Processor();
+}
@@ -3,6 +3,9 @@
 
 #include "txn/storage.h"
 
+// Number of records created by InitStorage().
+#define STORAGE_RECORDS 1000000
+
 Storage::~Storage() {
   // data_.~unordered_map();
   // images_.~unordered_map();
@@ -32,11 +35,43 @@ double Storage::Timestamp(Key key) {
   return timestamps_[key];
 }
 
+Storage::LockCounts* Storage::Counts(Key key) {
+  if (key >= lock_counts_.size()) {
+    lock_counts_.resize(key + 1);
+  }
+  return &lock_counts_[key];
+}
+
+uint64* Storage::TidWord(Key key) {
+  // committing txns hold pointers into the words, so they cannot grow here
+  if (key >= tid_words_.size()) {
+    DIE("TID word requested for key " << key << " outside storage.");
+  }
+  return &tid_words_[key];
+}
+
+uint64* Storage::TicTocWord(Key key) {
+  if (key >= tictoc_words_.size()) {
+    DIE("TICTOC word requested for key " << key << " outside storage.");
+  }
+  return &tictoc_words_[key];
+}
+
+uint64* Storage::TemperatureWord(Key key) {
+  if (key >= temperature_words_.size()) {
+    DIE("Temperature word requested for key " << key << " outside storage.");
+  }
+  return &temperature_words_[key];
+}
+
 // Init the storage
 void Storage::InitStorage() {
-  for (int i = 0; i < 1000000;i++) {
+  for (int i = 0; i < STORAGE_RECORDS;i++) {
     Write(i, 0, 0);
   } 
+  tid_words_.resize(STORAGE_RECORDS, 0);
+  tictoc_words_.resize(STORAGE_RECORDS, 0);
+  temperature_words_.resize(STORAGE_RECORDS, 0);
 }
 
 
@@ -8,6 +8,7 @@
 #include <tr1/unordered_map>
 #include <deque>
 #include <map>
+#include <vector>
 
 #include "txn/common.h"
 #include "txn/txn.h"
@@ -16,6 +17,7 @@
 using std::tr1::unordered_map;
 using std::deque;
 using std::map;
+using std::vector;
 
 
 class Storage {
@@ -78,6 +80,36 @@ class Storage {
   virtual void Unlock(Key key) {}
   
   virtual bool CheckWrite (Key key, int txn_unique_id) {return true;}
+
+  // The following are only used for VLL. Each record has two request counts:
+  // the number of txns in the VLL queue that will write it, and the number
+  // that will read it. They replace a lock queue per record.
+  struct LockCounts {
+    LockCounts() : exclusive_(0), shared_(0) {}
+    int exclusive_;
+    int shared_;
+  };
+
+  // Returns the request counts of the record with the specified key.
+  LockCounts* Counts(Key key);
+
+  // The following is only used for SILO. Returns the TID word of the record
+  // with the specified key: the TID of the txn that last wrote the record,
+  // with the low bit set while a committing txn holds the record locked.
+  // Dies if the record was not created by InitStorage().
+  uint64* TidWord(Key key);
+
+  // The following is only used for TICTOC. Returns the timestamp word of the
+  // record with the specified key, packing the write timestamp (wts) of its
+  // current version, how far past wts its read timestamp (rts) reaches, and
+  // a lock bit. Dies if the record was not created by InitStorage().
+  uint64* TicTocWord(Key key);
+
+  // The following is only used for MOCC. Returns the temperature word of the
+  // record with the specified key, counting recent validation failures on it
+  // together with when the count was last updated. Dies if the record was
+  // not created by InitStorage().
+  uint64* TemperatureWord(Key key);
    
  private:
  
@@ -97,6 +129,17 @@ class Storage {
   
    // Timestamps at which each key was last updated.
    unordered_map<Key, double> timestamps_;
+
+   // VLL request counts, indexed directly by key so that locking a record
+   // needs neither a hash lookup nor a heap allocation.
+   vector<LockCounts> lock_counts_;
+
+   // SILO TID words, TICTOC timestamp words and MOCC temperature words,
+   // indexed directly by key. They are allocated up front by InitStorage(),
+   // since committing txns update them concurrently.
+   vector<uint64> tid_words_;
+   vector<uint64> tictoc_words_;
+   vector<uint64> temperature_words_;
 };
 
 #endif  // _STORAGE_H_
@@ -2,6 +2,30 @@
 
 #include "txn/txn.h"
 
+void KeySignature::Clear() {
+  for (int i = 0; i < KEY_SIGNATURE_WORDS; i++) {
+    bits_[i] = 0;
+  }
+}
+
+void KeySignature::Add(const Key& key) {
+  // two bits per key, taken from the top of a multiplicative hash
+  const int bits = 64 * KEY_SIGNATURE_WORDS;
+  uint64 hash = key * 0x9E3779B97F4A7C15ULL;
+  int first = (hash >> 48) % bits;
+  int second = (hash >> 32) % bits;
+  bits_[first / 64] |= 1ULL << (first % 64);
+  bits_[second / 64] |= 1ULL << (second % 64);
+}
+
+bool KeySignature::Intersects(const KeySignature& other) const {
+  uint64 common = 0;
+  for (int i = 0; i < KEY_SIGNATURE_WORDS; i++) {
+    common |= bits_[i] & other.bits_[i];
+  }
+  return common != 0;
+}
+
 bool Txn::Read(const Key& key, Value* value) {
   // Check that key is in readset/writeset.
   if (readset_.count(key) == 0 && writeset_.count(key) == 0)
@@ -47,9 +71,22 @@ void Txn::CheckReadWriteSets() {
   }
 }
 
+void Txn::ComputeSignatures() {
+  read_signature_.Clear();
+  for (set<Key>::iterator it = readset_.begin(); it != readset_.end(); ++it) {
+    read_signature_.Add(*it);
+  }
+  write_signature_.Clear();
+  for (set<Key>::iterator it = writeset_.begin(); it != writeset_.end(); ++it) {
+    write_signature_.Add(*it);
+  }
+}
+
 void Txn::CopyTxnInternals(Txn* txn) const {
   txn->readset_ = set<Key>(this->readset_);
   txn->writeset_ = set<Key>(this->writeset_);
+  txn->read_signature_ = this->read_signature_;
+  txn->write_signature_ = this->write_signature_;
   txn->reads_ = map<Key, Value>(this->reads_);
   txn->writes_ = map<Key, Value>(this->writes_);
   txn->status_ = this->status_;
@@ -23,10 +23,32 @@ enum TxnStatus {
   ABORTED = 4,      // Aborted
 };
 
+struct KeyLock;
+
+// Number of 64-bit words in a KeySignature.
+#define KEY_SIGNATURE_WORDS 4
+
+// Fixed-width Bloom filter over a set of keys. If two sets' signatures have
+// no bit in common, the sets have no key in common; if they do, the sets
+// may or may not.
+struct KeySignature {
+  KeySignature() { Clear(); }
+
+  void Clear();
+
+  // Adds 'key' to the signature.
+  void Add(const Key& key);
+
+  // Returns true if the two signatures have a bit in common.
+  bool Intersects(const KeySignature& other) const;
+
+  uint64 bits_[KEY_SIGNATURE_WORDS];
+};
+
 class Txn {
  public:
   // Commit vote defauls to false. Only by calling "commit"
-  Txn() : status_(INCOMPLETE) {}
+  Txn() : data_type_(1), status_(INCOMPLETE), retries_(0) {}
   virtual ~Txn() {}
   virtual Txn * clone() const = 0;    // Virtual constructor (copying)
 
@@ -40,6 +62,10 @@ class Txn {
   // an error occurs.
   void CheckReadWriteSets();
 
+  // Computes 'read_signature_' and 'write_signature_' from the read and
+  // write sets. Called by the TxnProcessor when the txn is submitted.
+  void ComputeSignatures();
+
   // Unique, monotonically increasing transaction ID, assigned by TxnProcessor.
   uint64 unique_id_;
 
@@ -50,6 +76,7 @@ class Txn {
   void CopyTxnInternals(Txn* txn) const;
 
   friend class TxnProcessor;
+  friend void SortedLocks(const Txn* txn, vector<KeyLock>* locks);
 
   // Method to be used inside 'Execute()' function when reading records from
   // the database. If record corresponding with specified 'key' exists, sets
@@ -93,6 +120,10 @@ class Txn {
   // Set of all keys that may be updated when executing the transaction.
   set<Key> writeset_;
 
+  // Signatures of 'readset_' and 'writeset_'.
+  KeySignature read_signature_;
+  KeySignature write_signature_;
+
   // Results of reads performed by the transaction.
   map<Key, Value> reads_;
 
@@ -127,7 +158,7 @@ class Txn {
   map<Key, BlogString> writesBSTR_;
 
 
-  // data type: 1=numeric, 2=image, 3=string, 4=blogstring
+  // data type: 1=numeric (the default), 2=image, 3=string, 4=blogstring
 
   int data_type_;
 
@@ -138,6 +169,9 @@ class Txn {
 
   // Start time (used for OCC).
   double occ_start_time_;
+
+  // Number of times the TxnProcessor has restarted the txn after aborting it.
+  int retries_;
 };
 
 #endif  // _TXN_H_
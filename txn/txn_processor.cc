@@ -3,29 +3,255 @@
 // Modified by: Kun Ren (kun.ren@yale.edu)
 
 #include "txn/txn_processor.h"
+#include <sched.h>
 #include <stdio.h>
+#include <list>
 #include <set>
 #include <stdlib.h>
+#include <tr1/unordered_set>
 
 #include "txn/lock_manager.h"
 
 // Thread & queue counts for StaticThreadPool initialization.
 #define THREAD_COUNT 8
 
+// Seconds between passes of the TWOPL2 deadlock detector.
+#define DEADLOCK_DETECTION_INTERVAL 0.001
+
+// Length in seconds of a CALVIN sequencer epoch.
+#define CALVIN_EPOCH_DURATION 0.0005
+
+// Number of lock manager threads (key partitions) used by CALVIN.
+#define CALVIN_LOCK_THREADS 4
+
+// Default number of restarts after which an aborted txn is given up on.
+#define MAX_TXN_RETRIES 100
+
+// Bounds in seconds of the backoff window of a restarted txn, which starts
+// at the base and doubles with each retry of the txn up to the cap.
+#define RETRY_BACKOFF_BASE 0.00001
+#define RETRY_BACKOFF_CAP 0.001
+
+// Idle passes the scheduler loops that park spin through before parking,
+// which adapt between these bounds, and the longest a parked scheduler
+// sleeps before polling again.
+#define SCHEDULER_SPIN_MIN 16
+#define SCHEDULER_SPIN_MAX 4096
+#define SCHEDULER_PARK_TIMEOUT 0.01
+
+// Idle passes a run-to-completion worker spins through before parking, and
+// the longest it stays parked before looking at the other workers' shards.
+#define WORKER_SPIN_PASSES 64
+#define WORKER_PARK_TIMEOUT 0.001
+
+// Most completed txns validated together by the OCC scheduler.
+#define OCC_VALIDATION_BATCH 64
+
+// Threads of the OCC commit stages that install writes and that return
+// committed txns, and the most txns either takes at once. One thread each
+// lets the scheduler validate the next batch while the last one is applied
+// and returned. A stage with no threads runs on the scheduler thread.
+#define OCC_APPLY_WORKERS 1
+#define OCC_RESPOND_WORKERS 1
+#define OCC_STAGE_BATCH 64
+
+// Length in seconds of an ADAPTIVE scheduler window, and the number of
+// latest windows its switching decisions are based on.
+#define ADAPTIVE_WINDOW 0.01
+#define ADAPTIVE_SLIDE 4
+
+// ADAPTIVE switches from SILO to LOCKING once at least this fraction of txn
+// attempts is restarted, and back once under LOCKING fewer than
+// ADAPTIVE_ABORT_LOW are and txns wait on average under ADAPTIVE_WAIT_LOW
+// seconds for their locks. Windows with fewer than ADAPTIVE_MIN_ATTEMPTS
+// attempts in all decide nothing.
+#define ADAPTIVE_ABORT_HIGH 0.2
+#define ADAPTIVE_ABORT_LOW 0.02
+#define ADAPTIVE_WAIT_LOW 0.0001
+#define ADAPTIVE_MIN_ATTEMPTS 64
+
+// Length in seconds of a SILO epoch.
+#define SILO_EPOCH_DURATION 0.04
+
+// Layout of SILO TID words: the low bit locks the record, so TIDs advance in
+// steps of two, and a TID's bits from SILO_EPOCH_SHIFT up hold its epoch.
+#define SILO_LOCK_BIT 1
+#define SILO_TID_STEP 2
+#define SILO_EPOCH_SHIFT 32
+
+// Layout of TICTOC timestamp words: the top bit locks the record, the next
+// bits down hold rts - wts, and the low TICTOC_DELTA_SHIFT bits hold wts.
+#define TICTOC_LOCK_BIT (1ULL << 63)
+#define TICTOC_DELTA_SHIFT 48
+#define TICTOC_DELTA_MAX ((1ULL << 15) - 1)
+#define TICTOC_WTS_MASK ((1ULL << TICTOC_DELTA_SHIFT) - 1)
+
+// Layout of MOCC temperature words: the low MOCC_EPOCH_SHIFT bits count
+// recent validation failures on the record, and the bits above hold the
+// decay epoch the count was last updated in. A count halves every
+// MOCC_DECAY_INTERVAL seconds, and a record whose count is at least
+// MOCC_HOT_TEMPERATURE is locked rather than validated.
+#define MOCC_EPOCH_SHIFT 32
+#define MOCC_DECAY_INTERVAL 0.01
+#define MOCC_HOT_TEMPERATURE 4
+
+// Last commit TID chosen by each SILO worker thread. Together with the epoch
+// it keeps a worker's TIDs increasing without any shared counter.
+static __thread uint64 silo_worker_tid = 0;
+
+// Reads a TID or timestamp word that other threads may be updating.
+static inline uint64 LoadWord(const uint64* word) {
+  return *reinterpret_cast<const volatile uint64*>(word);
+}
+
+// Spins until 'lock_bit' of the word is clear, then sets it. Returns the
+// word as it was before locking.
+static inline uint64 LockWord(uint64* word, uint64 lock_bit) {
+  while (true) {
+    uint64 value = LoadWord(word);
+    if (!(value & lock_bit) and
+        __sync_bool_compare_and_swap(word, value, value | lock_bit)) {
+      return value;
+    }
+    sched_yield();
+  }
+}
+
+static inline uint64 TicTocWts(uint64 word) {
+  return word & TICTOC_WTS_MASK;
+}
+
+static inline uint64 TicTocRts(uint64 word) {
+  return TicTocWts(word) + ((word >> TICTOC_DELTA_SHIFT) & TICTOC_DELTA_MAX);
+}
+
+// Returns an unlocked TICTOC word for 'wts' and 'rts'. If rts is too far
+// past wts to be represented, wts is moved up to fit, which is safe since
+// wts only serves to tell versions apart.
+static inline uint64 TicTocPack(uint64 wts, uint64 rts) {
+  if (rts - wts > TICTOC_DELTA_MAX) {
+    wts = rts - TICTOC_DELTA_MAX;
+  }
+  return wts | ((rts - wts) << TICTOC_DELTA_SHIFT);
+}
+
+// Returns the temperature held in a MOCC temperature word, decayed to
+// 'epoch'.
+static inline uint64 MoccTemperature(uint64 word, uint64 epoch) {
+  uint64 age = epoch - (word >> MOCC_EPOCH_SHIFT);
+  if (age >= MOCC_EPOCH_SHIFT) {
+    return 0;
+  }
+  return (word & ((1ULL << MOCC_EPOCH_SHIFT) - 1)) >> age;
+}
+
 using namespace std;
+using std::tr1::unordered_set;
+
+// Bindings of each record type to its maps in a Txn and its calls on
+// Storage, used by the type-generic kernels below.
+template <>
+map<Key, Value>* TxnProcessor::ReadsOf<Value>(Txn* txn) { return &txn->reads_; }
+template <>
+map<Key, Value>* TxnProcessor::WritesOf<Value>(Txn* txn) { return &txn->writes_; }
+template <>
+bool TxnProcessor::StorageRead<Value>(Key key, Value* result) {
+  return storage_->Read(key, result);
+}
+template <>
+void TxnProcessor::StorageWrite<Value>(Key key, const Value& value, int id) {
+  storage_->Write(key, value, id);
+}
+
+template <>
+map<Key, Image>* TxnProcessor::ReadsOf<Image>(Txn* txn) { return &txn->readsIMG_; }
+template <>
+map<Key, Image>* TxnProcessor::WritesOf<Image>(Txn* txn) { return &txn->writesIMG_; }
+template <>
+bool TxnProcessor::StorageRead<Image>(Key key, Image* result) {
+  return storage_->ReadImage(key, result);
+}
+template <>
+void TxnProcessor::StorageWrite<Image>(Key key, const Image& value, int id) {
+  storage_->WriteImage(key, value, id);
+}
+
+template <>
+map<Key, String>* TxnProcessor::ReadsOf<String>(Txn* txn) { return &txn->readsSTR_; }
+template <>
+map<Key, String>* TxnProcessor::WritesOf<String>(Txn* txn) { return &txn->writesSTR_; }
+template <>
+bool TxnProcessor::StorageRead<String>(Key key, String* result) {
+  return storage_->ReadString(key, result);
+}
+template <>
+void TxnProcessor::StorageWrite<String>(Key key, const String& value, int id) {
+  storage_->WriteString(key, value, id);
+}
+
+template <>
+map<Key, BlogString>* TxnProcessor::ReadsOf<BlogString>(Txn* txn) {
+  return &txn->readsBSTR_;
+}
+template <>
+map<Key, BlogString>* TxnProcessor::WritesOf<BlogString>(Txn* txn) {
+  return &txn->writesBSTR_;
+}
+template <>
+bool TxnProcessor::StorageRead<BlogString>(Key key, BlogString* result) {
+  return storage_->ReadBlogString(key, result);
+}
+template <>
+void TxnProcessor::StorageWrite<BlogString>(Key key, const BlogString& value,
+                                            int id) {
+  storage_->WriteBlogString(key, value, id);
+}
+
+#define TXN_KERNELS(V) \
+  { &TxnProcessor::ExecuteTxnOf<V>, &TxnProcessor::ExecuteTxnParallelOf<V>, \
+    &TxnProcessor::ApplyWritesOf<V>, &TxnProcessor::ReadRecordOf<V>, \
+    &TxnProcessor::RewriteRecordOf<V> }
+
+const TxnProcessor::Kernels TxnProcessor::kernels_[] = {
+  TXN_KERNELS(Value),  // unused: data types start at 1
+  TXN_KERNELS(Value),
+  TXN_KERNELS(Image),
+  TXN_KERNELS(String),
+  TXN_KERNELS(BlogString),
+};
+
+const TxnProcessor::Kernels& TxnProcessor::KernelsFor(Txn* txn) {
+  if (txn->data_type_ < 1 or txn->data_type_ > 4) {
+    DIE("Txn has invalid data type: " << txn->data_type_);
+  }
+  return kernels_[txn->data_type_];
+}
 
-TxnProcessor::TxnProcessor(CCMode mode)
-    : mode_(mode), tp_(THREAD_COUNT), next_unique_id_(1) {
+TxnProcessor::TxnProcessor(CCMode mode, DeadlockPolicy policy)
+    : mode_(mode), policy_(policy), tp_(THREAD_COUNT), next_unique_id_(1),
+      max_retries_(MAX_TXN_RETRIES), silo_epoch_(1), mocc_epoch_(0),
+      adaptive_done_(0), execute_stats_("execute", THREAD_COUNT),
+      validate_stats_("validate", 1), execute_nanos_(0), stages_start_(0),
+      idle_passes_(0), spin_limit_(SCHEDULER_SPIN_MIN), stopped_(false) {
   if (mode_ == LOCKING_EXCLUSIVE_ONLY)
     lm_ = new LockManagerA(&ready_txns_);
   else if (mode_ == LOCKING)
     lm_ = new LockManagerB(&ready_txns_);
   else if (mode == TWOPL)
-    lm_ = new LockManagerC(&ready_txns_);
-  else if (mode == TWOPL2)
-    lm_ = new LockManagerD(&ready_txns_);
-  else if (mode == SILO)
+    lm_ = new LockManagerC(&ready_txns_, policy_);
+  else if (mode == TWOPL2) {
+    // Blocked TWOPL2 workers keep their other locks, so waits-for cycles
+    // must be broken by the detector.
+    LockManagerD* lm = new LockManagerD(&ready_txns_);
+    lm->StartDeadlockDetector(DEADLOCK_DETECTION_INTERVAL);
+    lm_ = lm;
+  }
+  else if (mode == P_OCC or mode == MOCC)
     lm_ = new LockManagerD(&ready_txns_);
+  else if (mode == ADAPTIVE)
+    lm_ = new LockManagerB(&ready_txns_);
+  else if (mode == CALVIN)
+    partitioned_lm_ = new PartitionedLockManager(CALVIN_LOCK_THREADS);
   
   // Create the storage
   if (mode_ == MVCC) {
@@ -34,6 +260,18 @@ TxnProcessor::TxnProcessor(CCMode mode)
     storage_ = new Storage();
   }
   
+  if (RunsToCompletion()) {
+    request_shards_.resize(THREAD_COUNT);
+    request_events_.resize(THREAD_COUNT);
+  }
+
+  apply_stage_ = NULL;
+  respond_stage_ = NULL;
+  stage_tp_ = NULL;
+  if (mode_ == OCC) {
+    StartCommitStages();
+  }
+
   storage_->InitStorage();
   storage_->InitImageStorage();
   storage_->InitStringStorage();
@@ -52,7 +290,6 @@ TxnProcessor::TxnProcessor(CCMode mode)
   CPU_SET(5, &cpuset);
   CPU_SET(6, &cpuset);  
   pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
-  pthread_t scheduler_;
   pthread_create(&scheduler_, &attr, StartScheduler, reinterpret_cast<void*>(this));
   
 }
@@ -63,20 +300,133 @@ void* TxnProcessor::StartScheduler(void * arg) {
 }
 
 TxnProcessor::~TxnProcessor() {
-  if (mode_ == LOCKING_EXCLUSIVE_ONLY || mode_ == LOCKING || mode_ == TWOPL || mode_ == TWOPL2)
+  // the scheduler may still hand tasks to the pool, and both use the lock
+  // manager and storage, so they stop in that order before anything is freed
+  stopped_ = true;
+  scheduler_event_.Notify();
+  pthread_join(scheduler_, NULL);
+  tp_.Stop();
+
+  if (mode_ == LOCKING_EXCLUSIVE_ONLY || mode_ == LOCKING || mode_ == TWOPL ||
+      mode_ == TWOPL2 || mode_ == P_OCC || mode_ == ADAPTIVE || mode_ == MOCC)
     delete lm_;
+  if (mode_ == CALVIN)
+    delete partitioned_lm_;
+  if (mode_ == OCC) {
+    // stops and joins any stage threads first
+    delete stage_tp_;
+    delete apply_stage_;
+    delete respond_stage_;
+  }
     
   delete storage_;
 }
 
 void TxnProcessor::NewTxnRequest(Txn* txn) {
-  // Atomically assign the txn a new number and add it to the incoming txn
-  // requests queue.
-  mutex_.Lock();
-  txn->unique_id_ = next_unique_id_;
-  next_unique_id_++;
-  txn_requests_.Push(txn);
-  mutex_.Unlock();
+  // The read and write sets are final by now.
+  txn->ComputeSignatures();
+
+  // Assign the txn a new number and add it to the incoming txn requests
+  // queue.
+  txn->unique_id_ = NextUniqueId();
+  SubmitTxn(txn);
+}
+
+void TxnProcessor::NewProcedureRequest(ProcedureRegistry* registry, int id,
+                                       const ProcedureParams& params) {
+  NewTxnRequest(registry->NewTxn(id, params));
+}
+
+uint64 TxnProcessor::NextUniqueId() {
+  return __sync_fetch_and_add(&next_unique_id_, 1);
+}
+
+bool TxnProcessor::RunsToCompletion() {
+  return mode_ == P_OCC || mode_ == MOCC || mode_ == SILO || mode_ == TICTOC;
+}
+
+bool TxnProcessor::ReleasesLocksEarly() {
+  return mode_ == LOCKING_EXCLUSIVE_ONLY || mode_ == LOCKING || mode_ == TWOPL;
+}
+
+void TxnProcessor::FinishLockedTxn(Txn* txn, vector<KeyLock>* locks) {
+  if (txn->Status() != COMPLETED_C && txn->Status() != COMPLETED_A) {
+    DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+  }
+
+  // waiters granted these locks start at once, reading the installed writes
+  SortedLocks(txn, locks);
+  lm_->ReleaseEarly(txn, *locks);
+  if (!lm_->CommitBlocked(txn)) {
+    CommitLockedTxns(txn);
+  }
+}
+
+void TxnProcessor::CommitLockedTxns(Txn* txn) {
+  vector<Txn*> ready(1, txn);
+  while (ready.size()) {
+    txn = ready.back();
+    ready.pop_back();
+    txn->status_ = (txn->Status() == COMPLETED_C) ? COMMITTED : ABORTED;
+
+    // the lock manager is done with the txn before the client may delete it
+    lm_->Committed(txn, &ready);
+    txn_results_.Push(txn);
+  }
+}
+
+void TxnProcessor::SubmitTxn(Txn* txn) {
+  if (RunsToCompletion()) {
+    int shard = txn->unique_id_ % request_shards_.size();
+    request_shards_[shard].Push(txn);
+    request_events_[shard].Notify();
+  } else {
+    txn_requests_.Push(txn);
+    scheduler_event_.Notify();
+  }
+}
+
+void TxnProcessor::StartWorkers() {
+  for (int i = 0; i < THREAD_COUNT; i++) {
+    tp_.RunTaskOn(i, new Method<TxnProcessor, void, int>(
+          this,
+          &TxnProcessor::RunWorker,
+          i));
+  }
+}
+
+void TxnProcessor::RunWorker(int shard) {
+  int shards = request_shards_.size();
+  int idle_passes = 0;
+  Txn* txn;
+  while (tp_.Active()) {
+    // Take the next request from this worker's shard, or else steal one.
+    bool found = false;
+    for (int i = 0; !found and i < shards; i++) {
+      found = request_shards_[(shard + i) % shards].Pop(&txn);
+    }
+
+    if (found) {
+      idle_passes = 0;
+      switch (mode_) {
+        case SILO:   ExecuteSiloTxn(txn); break;
+        case TICTOC: ExecuteTicTocTxn(txn); break;
+        default:     (this->*KernelsFor(txn).execute_parallel_)(txn); break;
+      }
+    } else if (++idle_passes >= WORKER_SPIN_PASSES) {
+      // Park until a request arrives on this shard. Requests landing on a
+      // busy worker's shard are picked up by the others once they time out.
+      EventCount* event = &request_events_[shard];
+      int key = event->PrepareWait();
+      if (request_shards_[shard].Size() > 0) {
+        event->CancelWait();
+      } else {
+        event->Wait(key, WORKER_PARK_TIMEOUT);
+      }
+    } else {
+      sched_yield();
+    }
+  }
 }
 
 Txn* TxnProcessor::GetTxnResult() {
@@ -99,44 +449,165 @@ void TxnProcessor::RunScheduler() {
     case MVCC:                   RunMVCCScheduler(); break;
     case TWOPL:                  RunLockingSchedulerTwo(); break;
     case TWOPL2:                 RunTwoScheduler(); break;
-    case SILO:                   RunOCCParallelScheduler(); break;
+    case SILO:                   RunSiloScheduler(); break;
+    case CALVIN:                 RunCalvinScheduler(); break;
+    case VLL:                    RunVLLScheduler(); break;
+    case TICTOC:                 RunTicTocScheduler(); break;
+    case ADAPTIVE:               RunAdaptiveScheduler(); break;
+    case MOCC:                   RunOCCParallelScheduler(); break;
+  }
+}
+
+void TxnProcessor::GetCommitStages(vector<CommitStageStats>* stages) {
+  stages->clear();
+  if (mode_ != OCC) {
+    return;
+  }
+
+  // the counters of the apply and respond threads are summed per stage
+  stages->push_back(execute_stats_);
+  stages->back().busy_ = execute_nanos_ / 1e9;
+  stages->back().batches_ = stages->back().txns_;
+  stages->push_back(validate_stats_);
+  CommitStage* pipeline[] = { apply_stage_, respond_stage_ };
+  for (int i = 0; i < 2; i++) {
+    vector<CommitStageStats>* threads = &pipeline[i]->stats_;
+    CommitStageStats stage((*threads)[0].name_, pipeline[i]->workers_);
+    for (vector<CommitStageStats>::iterator it = threads->begin();
+         it != threads->end(); ++it) {
+      stage.txns_ += it->txns_;
+      stage.batches_ += it->batches_;
+      stage.busy_ += it->busy_;
+      stage.max_queued_ = std::max(stage.max_queued_, it->max_queued_);
+    }
+    stages->push_back(stage);
+  }
+
+  double elapsed = GetTime() - stages_start_;
+  for (vector<CommitStageStats>::iterator it = stages->begin(); it != stages->end(); ++it) {
+    it->occupancy_ = it->busy_ / (std::max(it->workers_, 1) * elapsed);
+  }
+}
+
+void TxnProcessor::SetMaxRetries(int max_retries) {
+  delayed_mutex_.Lock();
+  max_retries_ = max_retries;
+  delayed_mutex_.Unlock();
+}
+
+void TxnProcessor::GetRetryStats(RetryStats* stats) {
+  delayed_mutex_.Lock();
+  *stats = retry_stats_;
+  delayed_mutex_.Unlock();
+}
+
+void TxnProcessor::GetAdaptiveLog(vector<AdaptiveWindow>* windows,
+                                  vector<AdaptiveSwitch>* switches) {
+  adaptive_mutex_.Lock();
+  *windows = adaptive_windows_;
+  *switches = adaptive_switches_;
+  adaptive_mutex_.Unlock();
+}
+
+void TxnProcessor::RestartTxn(Txn* txn) {
+  delayed_mutex_.Lock();
+  if (max_retries_ >= 0 and txn->retries_ >= max_retries_) {
+    retry_stats_.abandoned_++;
+    delayed_mutex_.Unlock();
+    txn->status_ = ABORTED;
+    txn_results_.Push(txn);
+    return;
+  }
+
+  // Txns that keep colliding back off further each time, so under
+  // contention restarts spread out instead of colliding again at once.
+  txn->retries_++;
+  double window = RETRY_BACKOFF_BASE;
+  for (int i = 1; i < txn->retries_ and window < RETRY_BACKOFF_CAP; i++) {
+    window *= 2;
+  }
+  if (window > RETRY_BACKOFF_CAP) {
+    window = RETRY_BACKOFF_CAP;
+  }
+  double delay = RandomDouble(window);
+  delayed_txns_.push(DelayedTxn(GetTime() + delay, txn));
+
+  retry_stats_.restarts_++;
+  retry_stats_.backoff_ += delay;
+  if (txn->retries_ > retry_stats_.max_retries_) {
+    retry_stats_.max_retries_ = txn->retries_;
+  }
+  delayed_mutex_.Unlock();
+
+  // a parked scheduler must wake up in time to resubmit it
+  scheduler_event_.Notify();
+}
+
+void TxnProcessor::WaitForWork(bool busy, bool admitting) {
+  if (busy) {
+    // work turning up while spinning means spinning longer may pay off
+    if (idle_passes_ > 0 and spin_limit_ < SCHEDULER_SPIN_MAX) {
+      spin_limit_ *= 2;
+    }
+    idle_passes_ = 0;
+    return;
+  }
+  if (++idle_passes_ < spin_limit_) {
+    return;
+  }
+
+  // Announce the wait first, so that a txn requested or completed from now
+  // on wakes this thread.
+  int key = scheduler_event_.PrepareWait();
+  double timeout = SCHEDULER_PARK_TIMEOUT;
+  delayed_mutex_.Lock();
+  if (!delayed_txns_.empty() and delayed_txns_.top().first - GetTime() < timeout) {
+    timeout = delayed_txns_.top().first - GetTime();
+  }
+  delayed_mutex_.Unlock();
+  if (timeout <= 0 or (admitting and txn_requests_.Size() > 0) or
+      completed_txns_.Size() > 0) {
+    scheduler_event_.CancelWait();
+    return;
+  }
+  scheduler_event_.Wait(key, timeout);
+  if (spin_limit_ > SCHEDULER_SPIN_MIN) {
+    spin_limit_ /= 2;
+  }
+}
+
+void TxnProcessor::ResubmitDelayedTxns() {
+  delayed_mutex_.Lock();
+  if (delayed_txns_.empty()) {
+    delayed_mutex_.Unlock();
+    return;
+  }
+  vector<Txn*> due;
+  double now = GetTime();
+  while (!delayed_txns_.empty() and delayed_txns_.top().first <= now) {
+    due.push_back(delayed_txns_.top().second);
+    delayed_txns_.pop();
+  }
+  delayed_mutex_.Unlock();
+
+  // Completely restart each txn.
+  for (vector<Txn*>::iterator it = due.begin(); it != due.end(); ++it) {
+    (*it)->unique_id_ = NextUniqueId();
+    SubmitTxn(*it);
   }
 }
 
 void TxnProcessor::RunSerialScheduler() {
   Txn* txn;
-  while (tp_.Active()) {
+  while (!stopped_) {
     // Get next txn request.
     if (txn_requests_.Pop(&txn)) {
       // Execute txn.
-      if (txn->data_type_ == 1){
-        ExecuteTxn(txn);
-      }
-      else if (txn->data_type_ == 2){
-        ExecuteImageTxn(txn);
-      }
-      else if (txn->data_type_ == 3){
-        ExecuteStringTxn(txn);
-      }
-      else if (txn->data_type_ == 4){
-        ExecuteBlogStringTxn(txn);
-      }
+      (this->*KernelsFor(txn).execute_)(txn);
 
       // Commit/abort txn according to program logic's commit/abort decision.
       if (txn->Status() == COMPLETED_C) {
-        // ApplyWrites(txn);
-        if (txn->data_type_ == 1){
-          ApplyWrites(txn);
-        }
-        else if (txn->data_type_ == 2){
-          ApplyImageWrites(txn);
-        }
-        else if (txn->data_type_ == 3){
-          ApplyStringWrites(txn);
-        }
-        else if (txn->data_type_ == 4){
-          ApplyBlogStringWrites(txn);
-        }
+        ApplyWrites(txn);
         txn->status_ = COMMITTED;
       } else if (txn->Status() == COMPLETED_A) {
         txn->status_ = ABORTED;
@@ -190,10 +661,14 @@ vector<pair<Key, bool>> TxnProcessor::KeySorter2(set<Key>* rset, set<Key>* wset)
 
   vector<pair<Key, bool>> setVector;
 
+  // a key that is both read and written only needs the write lock; a txn
+  // asking for both would wait behind its own read lock
   if (rlen != 0) {
     std::set<Key>::iterator it = rset->begin();
     for (; it != rset->end(); ++it) {
-      setVector.push_back(make_pair(*it, false));
+      if (wset->count(*it) == 0) {
+        setVector.push_back(make_pair(*it, false));
+      }
     }
   }
 
@@ -205,7 +680,7 @@ vector<pair<Key, bool>> TxnProcessor::KeySorter2(set<Key>* rset, set<Key>* wset)
   }
 
   uint64_t i, j, lowest;
-  for (i = 0; i < setVector.size() - 1; ++i) {
+  for (i = 0; i + 1 < setVector.size(); ++i) {
     lowest = i;
     for (j = i; j < setVector.size(); ++j) {
       if (setVector[j].first < setVector[lowest].first) {
@@ -222,6 +697,7 @@ vector<pair<Key, bool>> TxnProcessor::KeySorter2(set<Key>* rset, set<Key>* wset)
 
 
 void TxnProcessor::StartTwoExecuting(Txn *txn) {
+  const Kernels& kernels = KernelsFor(txn);
   uint64_t i;
   vector<pair<Key, bool>> setVector = KeySorter2(&(txn->readset_), &(txn->writeset_));
 
@@ -230,179 +706,86 @@ void TxnProcessor::StartTwoExecuting(Txn *txn) {
     bool isWrite = setVector[i].second;
 
     if (!isWrite) {
-      while (!lm_->ReadLock(txn, current)) {
-        //continue;
-        sleep(1); // adjust this if necessary
+      // parks this worker until the lock is handed over by Release()
+      if (!lm_->ReadLockBlocking(txn, current)) {
+        RestartTwoExecuting(txn, setVector, i);
+        return;
       }
 
-      if (txn->data_type_ == 1) {
-        Value result;
-        if (storage_->Read(current, &result))
-          txn->reads_[current] = result;
-      }
-      else if (txn->data_type_ == 2) {
-        Image result;
-        if (storage_->ReadImage(current, &result))
-          txn->readsIMG_[current] = result;
-      }
-      else if (txn->data_type_ == 3) {
-        String result;
-        if (storage_->ReadString(current, &result))
-          txn->readsSTR_[current] = result;
-      }
-      else if (txn->data_type_ == 4) {
-        BlogString result;
-        if (storage_->ReadBlogString(current, &result))
-          txn->readsBSTR_[current] = result;
-      }
+      (this->*kernels.read_record_)(txn, current);
     } else {
-      while (!lm_->WriteLock(txn, current)) {
-        //continue;
-        sleep(1); // adjust this if necessary
-      }
-
-      if (txn->data_type_ == 1) {
-        Value result;
-        if (storage_->Read(current, &result)) {
-          txn->writes_[current] = result;
-        }
-
-        storage_->Write(current, result, txn->unique_id_);
-      }
-      else if (txn->data_type_ == 2) {
-        Image result;
-        if (storage_->ReadImage(current, &result)) {
-          txn->readsIMG_[current] = result;
-        }
-
-        storage_->WriteImage(current, result, txn->unique_id_);
-      }
-      else if (txn->data_type_ == 3) {
-        String result;
-        if (storage_->ReadString(current, &result)) {
-          txn->readsSTR_[current] = result;
-        }
-
-        storage_->WriteString(current, result, txn->unique_id_);
+      if (!lm_->WriteLockBlocking(txn, current)) {
+        RestartTwoExecuting(txn, setVector, i);
+        return;
       }
-      else if (txn->data_type_ == 4) {
-        BlogString result;
-        if (storage_->ReadBlogString(current, &result)) {
-          txn->readsBSTR_[current] = result;
-        }
 
-        storage_->WriteBlogString(current, result, txn->unique_id_);
-      }
+      (this->*kernels.rewrite_record_)(txn, current);
     }
   }
 
-  //Key *sortedReadset = KeySorter(&(txn->readset_));
-  //for (i = 0; i < txn->readset_.size(); ++i) {
-  //  Key current = sortedReadset[i];
-
-  //  while (!lm_->ReadLock(txn, current)) {
-  //    //continue;
-  //    sleep(1); // adjust this if necessary
-  //  }
-
-  //  if (txn->data_type_ == 1) {
-  //    Value result;
-  //    if (storage_->Read(current, &result))
-  //      txn->reads_[current] = result;
-  //  }
-  //  else if (txn->data_type_ == 2) {
-  //    Image result;
-  //    if (storage_->ReadImage(current, &result))
-  //      txn->readsIMG_[current] = result;
-  //  }
-  //  else if (txn->data_type_ == 3) {
-  //    String result;
-  //    if (storage_->ReadString(current, &result))
-  //      txn->readsSTR_[current] = result;
-  //  }
-  //  else if (txn->data_type_ == 4) {
-  //    BlogString result;
-  //    if (storage_->ReadBlogString(current, &result))
-  //      txn->readsBSTR_[current] = result;
-  //  }
-  //}
-
-  //free(sortedReadset);
-
-  //Key *sortedWriteset = KeySorter(&(txn->writeset_));
-
-  //for (i = 0; i < txn->writeset_.size(); ++i) {
-  //  Key current = sortedWriteset[i];
-  //  while (!lm_->WriteLock(txn, current)) {
-  //    //continue;
-  //    sleep(1); // adjust this if necessary
-  //  }
-
-  //  if (txn->data_type_ == 1) {
-  //    Value result;
-  //    if (storage_->Read(current, &result)) {
-  //      txn->writes_[current] = result;
-  //    }
-
-  //    storage_->Write(current, result, txn->unique_id_);
-  //  }
-  //  else if (txn->data_type_ == 2) {
-  //    Image result;
-  //    if (storage_->ReadImage(current, &result)) {
-  //      txn->readsIMG_[current] = result;
-  //    }
-
-  //    storage_->WriteImage(current, result, txn->unique_id_);
-  //  }
-  //  else if (txn->data_type_ == 3) {
-  //    String result;
-  //    if (storage_->ReadString(current, &result)) {
-  //      txn->readsSTR_[current] = result;
-  //    }
-
-  //    storage_->WriteString(current, result, txn->unique_id_);
-  //  }
-  //  else if (txn->data_type_ == 4) {
-  //    BlogString result;
-  //    if (storage_->ReadBlogString(current, &result)) {
-  //      txn->readsBSTR_[current] = result;
-  //    }
-
-  //    storage_->WriteBlogString(current, result, txn->unique_id_);
-  //  }
-  //}
-
-  //free(sortedWriteset);
-
   // Execute txn's program logic.
   txn->Run();
 
+  // install its writes while still holding every lock
+  if (txn->Status() == COMPLETED_C) {
+    ApplyWrites(txn);
+    txn->status_ = COMMITTED;
+  } else if (txn->Status() == COMPLETED_A) {
+    txn->status_ = ABORTED;
+  } else {
+    DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+  }
+
   // shrinking phase
   for (i = 0; i < setVector.size(); ++i) {
     Key current = setVector[i].first;
     lm_->Release(txn, current);
   }
 
-  // shrinking phase
-  //for (i = 0; i < txn->readset_.size(); ++i) {
-  //  Key current = sortedReadset[i];
-  //  lm_->Release(txn, current);
-  //}
-
-  //// Release write locks.
-  //for (set<Key>::iterator it = txn->writeset_.begin();
-  //     it != txn->writeset_.end(); ++it) {
-  //  lm_->Release(txn, *it);
-  //}
-
   // Return result to client.
   txn_results_.Push(txn);
   return;
 }
 
+void TxnProcessor::RestartTwoExecuting(Txn* txn,
+                                       const vector<pair<Key, bool>>& setVector,
+                                       uint64_t acquired) {
+  // release the locks acquired so far (the request that was aborted has
+  // already been removed by the deadlock detector)
+  for (uint64_t i = 0; i < acquired; ++i) {
+    lm_->Release(txn, setVector[i].first);
+  }
+
+  // cleanup txn
+  ResetTxn(txn);
+
+  // restart txn, keeping its unique_id_ so that it is not picked as the
+  // youngest victim again and again
+  txn_requests_.Push(txn);
+}
+
+bool TxnProcessor::GetDeadlockStats(DeadlockStats* stats) {
+  if (mode_ == TWOPL) {
+    *stats = lock_aborts_;
+    return true;
+  } else if (mode_ == TWOPL2) {
+    *stats = static_cast<LockManagerD*>(lm_)->GetDeadlockStats();
+    return true;
+  }
+  return false;
+}
+
+LockProfiler* TxnProcessor::GetLockProfiler() {
+  if (mode_ == LOCKING_EXCLUSIVE_ONLY || mode_ == LOCKING || mode_ == TWOPL ||
+      mode_ == TWOPL2 || mode_ == P_OCC || mode_ == ADAPTIVE || mode_ == MOCC) {
+    return lm_->Profiler();
+  }
+  return NULL;
+}
+
 void TxnProcessor::RunTwoScheduler() {
   Txn* txn;
-  while (tp_.Active()) {
+  while (!stopped_) {
     // Start processing the next incoming transaction request.
     if (txn_requests_.Pop(&txn)) {
       // Start txn running in its own thread.
@@ -416,13 +799,18 @@ void TxnProcessor::RunTwoScheduler() {
 
 void TxnProcessor::RunLockingSchedulerTwo() {
   Txn* txn;
-  while (tp_.Active()) {
+  vector<KeyLock> locks;
+  while (!stopped_) {
     // Start processing the next incoming transaction request.
     if (txn_requests_.Pop(&txn)) {
       bool blocked = false;
-      // Request read locks.
+      // Request read locks. A key that is also written only takes the write
+      // lock below, as a read lock would conflict with it.
       for (set<Key>::iterator it = txn->readset_.begin();
            it != txn->readset_.end(); ++it) {
+        if (txn->writeset_.count(*it)) {
+          continue;
+        }
         if (!lm_->ReadLock(txn, *it)) {
           blocked = true;
           // If readset_.size() + writeset_.size() > 1, and blocked, just abort
@@ -471,51 +859,41 @@ void TxnProcessor::RunLockingSchedulerTwo() {
           ready_txns_.push_back(txn);
         }
       } else if (blocked == true && (txn->writeset_.size() + txn->readset_.size() > 1)){
-        mutex_.Lock();
-        //txn->unique_id_ = next_unique_id_;
-        //next_unique_id_++;
+        lock_aborts_.dies_++;
         txn_requests_.Push(txn);
-        mutex_.Unlock(); 
       }
-    }
 
-    // Process and commit all transactions that have finished running.
-    while (completed_txns_.Pop(&txn)) {
-      // Commit/abort txn according to program logic's commit/abort decision.
-      if (txn->Status() == COMPLETED_C) {
-        if (txn->data_type_ == 1){
-          ApplyWrites(txn);
-        }
-        else if (txn->data_type_ == 2){
-          ApplyImageWrites(txn);
-        }
-        else if (txn->data_type_ == 3){
-          ApplyStringWrites(txn);
-        }
-        else if (txn->data_type_ == 4){
-          ApplyBlogStringWrites(txn);
+      // Under wound-wait, abort the younger txns this request wounded that
+      // are still waiting on locks. They keep their unique_id_ on restart.
+      // Releasing their requests may make this txn ready, so this comes
+      // after the ReadyExecute check above.
+      if (policy_ == WOUND_WAIT) {
+        vector<Txn*> wounded;
+        static_cast<LockManagerC*>(lm_)->TakeWoundedTxns(&wounded);
+        for (vector<Txn*>::iterator it = wounded.begin(); it != wounded.end(); ++it) {
+          Txn* victim = *it;
+          // releasing an earlier victim may have granted this one its last
+          // lock, in which case it is already in ready_txns_ and must run
+          if (lm_->ReadyExecute(victim)) {
+            continue;
+          }
+          for (set<Key>::iterator key = victim->readset_.begin();
+               key != victim->readset_.end(); ++key) {
+            lm_->Release(victim, *key);
+          }
+          for (set<Key>::iterator key = victim->writeset_.begin();
+               key != victim->writeset_.end(); ++key) {
+            lm_->Release(victim, *key);
+          }
+          lock_aborts_.wounds_++;
+          txn_requests_.Push(victim);
         }
-        txn->status_ = COMMITTED;
-      } else if (txn->Status() == COMPLETED_A) {
-        txn->status_ = ABORTED;
-      } else {
-        // Invalid TxnStatus!
-        DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
-      }
-      
-      // Release read locks.
-      for (set<Key>::iterator it = txn->readset_.begin();
-           it != txn->readset_.end(); ++it) {
-        lm_->Release(txn, *it);
-      }
-      // Release write locks.
-      for (set<Key>::iterator it = txn->writeset_.begin();
-           it != txn->writeset_.end(); ++it) {
-        lm_->Release(txn, *it);
       }
+    }
 
-      // Return result to client.
-      txn_results_.Push(txn);
+    // Process and commit all transactions that have finished running.
+    while (completed_txns_.Pop(&txn)) {
+      FinishLockedTxn(txn, &locks);
     }
 
     // Start executing all transactions that have newly acquired all their
@@ -524,125 +902,171 @@ void TxnProcessor::RunLockingSchedulerTwo() {
       // Get next ready txn from the queue.
       txn = ready_txns_.front();
       ready_txns_.pop_front();
+      SortedLocks(txn, &locks);
+      lm_->AddCommitDependencies(txn, locks);
 
-      if (txn->data_type_ == 1){
-        // Start txn running in its own thread.
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteTxn,
-            txn));
-      }
-      else if (txn->data_type_ == 2){
-        // Start txn running in its own thread.
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteImageTxn,
-            txn));
-      }
-      else if (txn->data_type_ == 3){
-        // Start txn running in its own thread.
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteStringTxn,
-            txn));
-      }
-      else if (txn->data_type_ == 4){
-        // Start txn running in its own thread.
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteBlogStringTxn,
-            txn));
-      }
-
-      // // Start txn running in its own thread.
-      // tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-      //       this,
-      //       &TxnProcessor::ExecuteTxn,
-      //       txn));
-
+      // Start txn running in its own thread.
+      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
+          this,
+          KernelsFor(txn).execute_,
+          txn));
     }
   }
 }
 
 void TxnProcessor::RunLockingScheduler() {
   Txn* txn;
-  while (tp_.Active()) {
+  vector<KeyLock> locks;
+  while (!stopped_) {
+    ResubmitDelayedTxns();
+    bool busy = false;
+
     // Start processing the next incoming transaction request.
     if (txn_requests_.Pop(&txn)) {
-      bool blocked = false;
-      // Request read locks.
-      for (set<Key>::iterator it = txn->readset_.begin();
-           it != txn->readset_.end(); ++it) {
-        if (!lm_->ReadLock(txn, *it)) {
-          blocked = true;
-          // If readset_.size() + writeset_.size() > 1, and blocked, just abort
-          if (txn->readset_.size() + txn->writeset_.size() > 1) {
-            // Release all locks that already acquired
-            for (set<Key>::iterator it_reads = txn->readset_.begin(); true; ++it_reads) {
-              lm_->Release(txn, *it_reads);
-              if (it_reads == it) {
-                break;
-              }
-            }
-            break;
-          }
-        }
+      busy = true;
+      // Request all read and write locks as one batch. A txn with a single
+      // lock waits for it; a txn that needs more than one is not granted any
+      // unless it can have them all.
+      SortedLocks(txn, &locks);
+      bool wait = (locks.size() <= 1);
+
+      // If all read and write locks were immediately acquired, this txn is
+      // ready to be executed. Else, just restart the txn
+      if (lm_->AcquireAll(txn, locks, wait)) {
+        ready_txns_.push_back(txn);
+      } else if (!wait) {
+        RestartTxn(txn);
       }
-          
-      if (blocked == false) {
-        // Request write locks.
-        for (set<Key>::iterator it = txn->writeset_.begin();
-             it != txn->writeset_.end(); ++it) {
-          if (!lm_->WriteLock(txn, *it)) {
-            blocked = true;
-            // If readset_.size() + writeset_.size() > 1, and blocked, just abort
-            if (txn->readset_.size() + txn->writeset_.size() > 1) {
-              // Release all read locks that already acquired
-              for (set<Key>::iterator it_reads = txn->readset_.begin(); it_reads != txn->readset_.end(); ++it_reads) {
-                lm_->Release(txn, *it_reads);
-              }
-              // Release all write locks that already acquired
-              for (set<Key>::iterator it_writes = txn->writeset_.begin(); true; ++it_writes) {
-                lm_->Release(txn, *it_writes);
-                if (it_writes == it) {
-                  break;
-                }
-              }
-              break;
-            }
-          }
+    }
+
+    // Process and commit all transactions that have finished running.
+    while (completed_txns_.Pop(&txn)) {
+      busy = true;
+      FinishLockedTxn(txn, &locks);
+    }
+
+    // Start executing all transactions that have newly acquired all their
+    // locks.
+    while (ready_txns_.size()) {
+      // Get next ready txn from the queue.
+      txn = ready_txns_.front();
+      ready_txns_.pop_front();
+      busy = true;
+      SortedLocks(txn, &locks);
+      lm_->AddCommitDependencies(txn, locks);
+
+      // Start txn running in its own thread.
+      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
+          this,
+          KernelsFor(txn).execute_,
+          txn));
+    }
+
+    WaitForWork(busy);
+  }
+}
+
+void TxnProcessor::RunCalvinScheduler() {
+  Txn* txn;
+
+  // Txns sequenced into the current epoch, in sequence order.
+  vector<Txn*> epoch;
+  double epoch_start = GetTime();
+
+  while (!stopped_) {
+    // Sequencer: append all pending requests to the current epoch.
+    while (txn_requests_.Pop(&txn)) {
+      epoch.push_back(txn);
+    }
+
+    // At the end of each epoch, hand every lock of every txn to the lock
+    // threads in sequence order. A denied request simply stays queued in its
+    // partition until the txns ahead of it release, so nothing is ever
+    // aborted.
+    if (GetTime() >= epoch_start + CALVIN_EPOCH_DURATION) {
+      for (vector<Txn*>::iterator it = epoch.begin(); it != epoch.end(); ++it) {
+        partitioned_lm_->Acquire(*it);
+      }
+      epoch.clear();
+      epoch_start = GetTime();
+    }
+
+    // Process and commit all transactions that have finished running.
+    while (completed_txns_.Pop(&txn)) {
+      // Commit/abort txn according to program logic's commit/abort decision.
+      if (txn->Status() == COMPLETED_C) {
+        ApplyWrites(txn);
+        txn->status_ = COMMITTED;
+      } else if (txn->Status() == COMPLETED_A) {
+        txn->status_ = ABORTED;
+      } else {
+        // Invalid TxnStatus!
+        DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+      }
+
+      // Release all locks.
+      partitioned_lm_->Release(txn);
+
+      // Return result to client.
+      txn_results_.Push(txn);
+    }
+
+    // Start executing all transactions that have acquired all their locks.
+    while (partitioned_lm_->NextReady(&txn)) {
+      // Start txn running in its own thread.
+      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
+            this,
+            KernelsFor(txn).execute_,
+            txn));
+    }
+  }
+}
+
+void TxnProcessor::RunVLLScheduler() {
+  Txn* txn;
+  vector<KeyLock> locks;
+
+  // Every txn that has arrived but not yet committed, in arrival order, with
+  // each txn's position in it, and the ones among them that are blocked.
+  // A txn is removed before its result is returned, since the client may
+  // then free it.
+  list<Txn*> vll_queue;
+  unordered_map<Txn*, list<Txn*>::iterator> positions;
+  unordered_set<Txn*> blocked;
+
+  while (!stopped_) {
+    // Count the new txn's requests on each of its records. It is free to run
+    // if nothing else queued writes what it touches, or reads what it writes.
+    if (txn_requests_.Pop(&txn)) {
+      SortedLocks(txn, &locks);
+      bool free = true;
+      for (vector<KeyLock>::iterator it = locks.begin(); it != locks.end(); ++it) {
+        Storage::LockCounts* counts = storage_->Counts(it->key_);
+        if (it->mode_ == EXCLUSIVE) {
+          counts->exclusive_++;
+          if (counts->exclusive_ > 1 or counts->shared_ > 0)
+            free = false;
+        } else {
+          counts->shared_++;
+          if (counts->exclusive_ > 0)
+            free = false;
         }
       }
 
-      // If all read and write locks were immediately acquired, this txn is
-      // ready to be executed. Else, just restart the txn
-      if (blocked == false) {
+      positions[txn] = vll_queue.insert(vll_queue.end(), txn);
+      if (free) {
         ready_txns_.push_back(txn);
-      } else if (blocked == true && (txn->writeset_.size() + txn->readset_.size() > 1)){
-        mutex_.Lock();
-        txn->unique_id_ = next_unique_id_;
-        next_unique_id_++;
-        txn_requests_.Push(txn);
-        mutex_.Unlock(); 
+      } else {
+        blocked.insert(txn);
       }
     }
 
     // Process and commit all transactions that have finished running.
+    bool released = false;
     while (completed_txns_.Pop(&txn)) {
       // Commit/abort txn according to program logic's commit/abort decision.
       if (txn->Status() == COMPLETED_C) {
-        if (txn->data_type_ == 1){
-          ApplyWrites(txn);
-        }
-        else if (txn->data_type_ == 2){
-          ApplyImageWrites(txn);
-        }
-        else if (txn->data_type_ == 3){
-          ApplyStringWrites(txn);
-        }
-        else if (txn->data_type_ == 4){
-          ApplyBlogStringWrites(txn);
-        }
+        ApplyWrites(txn);
         txn->status_ = COMMITTED;
       } else if (txn->Status() == COMPLETED_A) {
         txn->status_ = ABORTED;
@@ -650,69 +1074,84 @@ void TxnProcessor::RunLockingScheduler() {
         // Invalid TxnStatus!
         DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
       }
-      
-      // Release read locks.
-      for (set<Key>::iterator it = txn->readset_.begin();
-           it != txn->readset_.end(); ++it) {
-        lm_->Release(txn, *it);
-      }
-      // Release write locks.
-      for (set<Key>::iterator it = txn->writeset_.begin();
-           it != txn->writeset_.end(); ++it) {
-        lm_->Release(txn, *it);
+
+      // Release all locks.
+      SortedLocks(txn, &locks);
+      for (vector<KeyLock>::iterator it = locks.begin(); it != locks.end(); ++it) {
+        Storage::LockCounts* counts = storage_->Counts(it->key_);
+        if (it->mode_ == EXCLUSIVE) {
+          counts->exclusive_--;
+        } else {
+          counts->shared_--;
+        }
       }
+      unordered_map<Txn*, list<Txn*>::iterator>::iterator position =
+          positions.find(txn);
+      vll_queue.erase(position->second);
+      positions.erase(position);
+      released = true;
 
       // Return result to client.
       txn_results_.Push(txn);
     }
 
-    // Start executing all transactions that have newly acquired all their
-    // locks.
+    if (released) {
+      // A blocked txn that reaches the front conflicts with nothing ahead of
+      // it.
+      if (!vll_queue.empty() and blocked.erase(vll_queue.front())) {
+        ready_txns_.push_back(vll_queue.front());
+      }
+
+      // Selective contention analysis: unblock every txn further back that
+      // conflicts with no unfinished txn ahead of it either. This scans the
+      // whole queue, so it only runs when too few txns are running to keep
+      // the execution threads busy.
+      if (!blocked.empty() and vll_queue.size() - blocked.size() < THREAD_COUNT) {
+        unordered_set<Key> written;
+        unordered_set<Key> read;
+        for (list<Txn*>::iterator it = vll_queue.begin(); it != vll_queue.end(); ++it) {
+          SortedLocks(*it, &locks);
+          if (blocked.count(*it)) {
+            bool free = true;
+            for (vector<KeyLock>::iterator lock = locks.begin(); lock != locks.end(); ++lock) {
+              if (written.count(lock->key_) or
+                  (lock->mode_ == EXCLUSIVE and read.count(lock->key_))) {
+                free = false;
+                break;
+              }
+            }
+            if (free) {
+              blocked.erase(*it);
+              ready_txns_.push_back(*it);
+            }
+          }
+          for (vector<KeyLock>::iterator lock = locks.begin(); lock != locks.end(); ++lock) {
+            if (lock->mode_ == EXCLUSIVE) {
+              written.insert(lock->key_);
+            } else {
+              read.insert(lock->key_);
+            }
+          }
+        }
+      }
+    }
+
+    // Start executing all transactions that are free to run.
     while (ready_txns_.size()) {
-      // Get next ready txn from the queue.
       txn = ready_txns_.front();
       ready_txns_.pop_front();
 
-      if (txn->data_type_ == 1){
-        // Start txn running in its own thread.
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteTxn,
-            txn));
-      }
-      else if (txn->data_type_ == 2){
-        // Start txn running in its own thread.
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteImageTxn,
-            txn));
-      }
-      else if (txn->data_type_ == 3){
-        // Start txn running in its own thread.
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteStringTxn,
-            txn));
-      }
-      else if (txn->data_type_ == 4){
-        // Start txn running in its own thread.
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
+      // Start txn running in its own thread.
+      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
             this,
-            &TxnProcessor::ExecuteBlogStringTxn,
+            KernelsFor(txn).execute_,
             txn));
-      }
-      // Start txn running in its own thread.
-      // printf("this is the type: %d\n", txn->data_type_);
-      // tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-      //       this,
-      //       &TxnProcessor::ExecuteTxn,
-      //       txn));
-
     }
   }
 }
 
-void TxnProcessor::ExecuteTxn(Txn* txn) {
+template <typename V>
+void TxnProcessor::ExecuteTxnOf(Txn* txn) {
 
   // Get the start time
   txn->occ_start_time_ = GetTime();
@@ -720,934 +1159,887 @@ void TxnProcessor::ExecuteTxn(Txn* txn) {
   // Read everything in from readset.
   for (set<Key>::iterator it = txn->readset_.begin();
        it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Value result;
-    if (storage_->Read(*it, &result))
-      txn->reads_[*it] = result;
+    ReadRecordOf<V>(txn, *it);
   }
 
   // Also read everything in from writeset.
   for (set<Key>::iterator it = txn->writeset_.begin();
        it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Value result;
-    if (storage_->Read(*it, &result))
-      txn->reads_[*it] = result;
+    ReadRecordOf<V>(txn, *it);
   }
 
 
   // Execute txn's program logic.
   txn->Run();
 
+  // Install the writes while the txn still holds its locks, so they can be
+  // released as soon as the scheduler sees it complete.
+  if (ReleasesLocksEarly() && txn->Status() == COMPLETED_C) {
+    ApplyWritesOf<V>(txn);
+  }
+
+  if (mode_ == OCC) {
+    __sync_fetch_and_add(&execute_nanos_,
+                         static_cast<uint64>((GetTime() - txn->occ_start_time_) * 1e9));
+  }
+
   // Hand the txn back to the RunScheduler thread.
   completed_txns_.Push(txn);
+  scheduler_event_.Notify();
 }
 
-void TxnProcessor::ExecuteImageTxn(Txn* txn) {
-
-  // Get the start time
-  txn->occ_start_time_ = GetTime();
-
-  // modified code for images
-
-  // Read everything in from readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
-       it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Image result;
-    if (storage_->ReadImage(*it, &result))
-      txn->readsIMG_[*it] = result;
+template <typename V>
+void TxnProcessor::ApplyWritesOf(Txn* txn) {
+  // Write buffered writes out to storage.
+  map<Key, V>* writes = WritesOf<V>(txn);
+  for (typename map<Key, V>::iterator it = writes->begin();
+       it != writes->end(); ++it) {
+    StorageWrite<V>(it->first, it->second, txn->unique_id_);
   }
+}
 
-  // Also read everything in from writeset.
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Image result;
-    if (storage_->ReadImage(*it, &result))
-      txn->readsIMG_[*it] = result;
-  }
+template <typename V>
+void TxnProcessor::ReadRecordOf(Txn* txn, Key key) {
+  // Save the read result iff record exists in storage.
+  V result;
+  if (StorageRead<V>(key, &result))
+    (*ReadsOf<V>(txn))[key] = result;
+}
 
+template <typename V>
+void TxnProcessor::RewriteRecordOf(Txn* txn, Key key) {
+  V result = V();
+  if (StorageRead<V>(key, &result))
+    (*ReadsOf<V>(txn))[key] = result;
 
-  // Execute txn's program logic.
-  txn->Run();
+  StorageWrite<V>(key, result, txn->unique_id_);
+}
 
-  // Hand the txn back to the RunScheduler thread.
-  completed_txns_.Push(txn);
+void TxnProcessor::ApplyWrites(Txn* txn) {
+  (this->*KernelsFor(txn).apply_writes_)(txn);
 }
 
-void TxnProcessor::ExecuteStringTxn(Txn* txn) {
+void TxnProcessor::ReadRecord(Txn* txn, Key key) {
+  (this->*KernelsFor(txn).read_record_)(txn, key);
+}
 
-  // Get the start time
-  txn->occ_start_time_ = GetTime();
+void TxnProcessor::ResetTxn(Txn* txn) {
+  txn->reads_.clear();
+  txn->writes_.clear();
+  txn->readsIMG_.clear();
+  txn->writesIMG_.clear();
+  txn->readsSTR_.clear();
+  txn->writesSTR_.clear();
+  txn->readsBSTR_.clear();
+  txn->writesBSTR_.clear();
+  txn->status_ = INCOMPLETE;
+}
 
-  // modified code for strings
+void TxnProcessor::RunOCCScheduler() {
+  Txn* txn;
 
-  // Read everything in from readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
-       it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    String result;
-    if (storage_->ReadString(*it, &result))
-      txn->readsSTR_[*it] = result;
-  }
+  // Completed txns validated together, and for every key written by a
+  // validated txn whose writes are not installed yet, the number of them.
+  vector<Txn*> batch;
+  unordered_map<Key, int> in_flight;
+  batch.reserve(OCC_VALIDATION_BATCH);
 
-  // Also read everything in from writeset.
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    String result;
-    if (storage_->ReadString(*it, &result))
-      txn->readsSTR_[*it] = result;
-  }
+  while (!stopped_) {
+    ResubmitDelayedTxns();
 
+    // Pass the next new transaction request to an execution thread.
+    bool requested = txn_requests_.Pop(&txn);
+    if (requested) {
+      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
+            this,
+            KernelsFor(txn).execute_,
+            txn));
+    }
 
-  // Execute txn's program logic.
-  txn->Run();
+    // Validation Phase: take up to a batch of finished transactions.
+    uint64 queued = completed_txns_.Size();
+    while (batch.size() < OCC_VALIDATION_BATCH and completed_txns_.Pop(&txn)) {
+      batch.push_back(txn);
+    }
 
-  // Hand the txn back to the RunScheduler thread.
-  completed_txns_.Push(txn);
-}
+    // Txns whose writes are now installed take them out of flight, and go
+    // on to be returned. Done just before validating, so a txn that started
+    // after an install is not failed on the write it saw.
+    bool applied = false;
+    while (applied_txns_.Pop(&txn)) {
+      applied = true;
+      for (set<Key>::iterator key = txn->writeset_.begin();
+           key != txn->writeset_.end(); ++key) {
+        unordered_map<Key, int>::iterator it = in_flight.find(*key);
+        if (--it->second == 0) {
+          in_flight.erase(it);
+        }
+      }
+      respond_stage_->queue_.Push(txn);
+    }
+    if (applied) {
+      HandOff(respond_stage_);
+    }
 
-void TxnProcessor::ExecuteBlogStringTxn(Txn* txn) {
+    WaitForWork(requested or applied or !batch.empty());
+    if (batch.empty()) {
+      continue;
+    }
+    double start = GetTime();
+
+    // Validate in completion order. Besides records updated in storage since
+    // it started, a txn conflicts with the writes in flight, which include
+    // those of the txns validated ahead of it in the batch.
+    bool validated_any = false;
+    for (vector<Txn*>::iterator it = batch.begin(); it != batch.end(); ++it) {
+      txn = *it;
+      if (txn->Status() == COMPLETED_A) {
+        txn->status_ = ABORTED;
+        txn_results_.Push(txn);
+        continue;
+      }
 
-  // Get the start time
-  txn->occ_start_time_ = GetTime();
+      bool validated = true;
+      for (set<Key>::iterator key = txn->readset_.begin();
+           validated and key != txn->readset_.end(); ++key) {
+        validated = in_flight.count(*key) == 0 and
+                    storage_->Timestamp(*key) <= txn->occ_start_time_;
+      }
+      for (set<Key>::iterator key = txn->writeset_.begin();
+           validated and key != txn->writeset_.end(); ++key) {
+        validated = in_flight.count(*key) == 0 and
+                    storage_->Timestamp(*key) <= txn->occ_start_time_;
+      }
 
-  // modified code for blog strings
+      if (validated) {
+        for (set<Key>::iterator key = txn->writeset_.begin();
+             key != txn->writeset_.end(); ++key) {
+          in_flight[*key]++;
+        }
+        apply_stage_->queue_.Push(txn);
+        validated_any = true;
+      } else {
+        // Completely restart the transaction.
+        ResetTxn(txn);
+        RestartTxn(txn);
+      }
+    }
 
-  // Read everything in from readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
-       it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    BlogString result;
-    if (storage_->ReadBlogString(*it, &result))
-      txn->readsBSTR_[*it] = result;
-  }
+    execute_stats_.txns_ += batch.size();
+    validate_stats_.txns_ += batch.size();
+    validate_stats_.batches_++;
+    validate_stats_.busy_ += GetTime() - start;
+    validate_stats_.max_queued_ = std::max(validate_stats_.max_queued_, queued);
+    batch.clear();
 
-  // Also read everything in from writeset.
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    BlogString result;
-    if (storage_->ReadBlogString(*it, &result))
-      txn->readsBSTR_[*it] = result;
+    if (validated_any) {
+      HandOff(apply_stage_);
+    }
   }
-
-
-  // Execute txn's program logic.
-  txn->Run();
-
-  // Hand the txn back to the RunScheduler thread.
-  completed_txns_.Push(txn);
 }
 
-void TxnProcessor::ApplyWrites(Txn* txn) {
-  // Write buffered writes out to storage.
-  for (map<Key, Value>::iterator it = txn->writes_.begin();
-       it != txn->writes_.end(); ++it) {
-    storage_->Write(it->first, it->second, txn->unique_id_);
+void TxnProcessor::StartCommitStages() {
+  apply_stage_ = new CommitStage("apply", OCC_APPLY_WORKERS, OCC_STAGE_BATCH,
+                                 &TxnProcessor::ApplyStage);
+  respond_stage_ = new CommitStage("respond", OCC_RESPOND_WORKERS, OCC_STAGE_BATCH,
+                                   &TxnProcessor::RespondStage);
+  stages_start_ = GetTime();
+  if (OCC_APPLY_WORKERS + OCC_RESPOND_WORKERS == 0) {
+    return;
   }
 
+  stage_tp_ = new StaticThreadPool(OCC_APPLY_WORKERS + OCC_RESPOND_WORKERS);
+  int thread = 0;
+  CommitStage* pipeline[] = { apply_stage_, respond_stage_ };
+  for (int i = 0; i < 2; i++) {
+    for (int worker = 0; worker < pipeline[i]->workers_; worker++) {
+      stage_tp_->RunTaskOn(thread++, new Method<TxnProcessor, void, CommitStage*, int>(
+            this,
+            &TxnProcessor::RunCommitStage,
+            pipeline[i],
+            worker));
+    }
+  }
 }
 
-void TxnProcessor::ApplyImageWrites(Txn* txn) {
-
-  //modified code for images
-
-  // Write buffered writes out to storage.
-  for (map<Key, Image>::iterator it = txn->writesIMG_.begin();
-       it != txn->writesIMG_.end(); ++it) {
-    storage_->WriteImage(it->first, it->second, txn->unique_id_);
+void TxnProcessor::HandOff(CommitStage* stage) {
+  if (stage->workers_ == 0) {
+    while (ProcessStage(stage, 0)) {}
+  } else {
+    stage->event_.Notify();
   }
-
 }
 
-void TxnProcessor::ApplyStringWrites(Txn* txn) {
-  // Write buffered writes out to storage.
-  for (map<Key, String>::iterator it = txn->writesSTR_.begin();
-       it != txn->writesSTR_.end(); ++it) {
-      storage_->WriteString(it->first, it->second, txn->unique_id_);
+bool TxnProcessor::ProcessStage(CommitStage* stage, int worker) {
+  vector<Txn*>* batch = &stage->batches_[worker];
+  uint64 queued = stage->queue_.Size();
+  Txn* txn;
+  while (static_cast<int>(batch->size()) < stage->batch_ and stage->queue_.Pop(&txn)) {
+    batch->push_back(txn);
+  }
+  if (batch->empty()) {
+    return false;
   }
 
+  CommitStageStats* stats = &stage->stats_[worker];
+  double start = GetTime();
+  (this->*stage->process_)(batch);
+  stats->txns_ += batch->size();
+  stats->batches_++;
+  stats->busy_ += GetTime() - start;
+  stats->max_queued_ = std::max(stats->max_queued_, queued);
+  batch->clear();
+  return true;
 }
 
-void TxnProcessor::ApplyBlogStringWrites(Txn* txn) {
-  // Write buffered writes out to storage.
-  for (map<Key, BlogString>::iterator it = txn->writesBSTR_.begin();
-       it != txn->writesBSTR_.end(); ++it) {
-    storage_->WriteBlogString(it->first, it->second, txn->unique_id_);
+void TxnProcessor::RunCommitStage(CommitStage* stage, int worker) {
+  int idle_passes = 0;
+  while (stage_tp_->Active()) {
+    if (ProcessStage(stage, worker)) {
+      idle_passes = 0;
+    } else if (++idle_passes >= WORKER_SPIN_PASSES) {
+      // park until the stage before queues more
+      int key = stage->event_.PrepareWait();
+      if (stage->queue_.Size() > 0) {
+        stage->event_.CancelWait();
+      } else {
+        stage->event_.Wait(key, WORKER_PARK_TIMEOUT);
+      }
+    } else {
+      sched_yield();
+    }
   }
-
 }
 
-void TxnProcessor::ExecuteOCCTxn(Txn* txn) {
-  if (txn->data_type_ == 1){
-    ExecuteTxn(txn);
-  }
-  else if (txn->data_type_ == 2){
-    ExecuteImageTxn(txn);
+void TxnProcessor::ApplyStage(vector<Txn*>* batch) {
+  for (vector<Txn*>::iterator it = batch->begin(); it != batch->end(); ++it) {
+    ApplyWrites(*it);
   }
-  else if (txn->data_type_ == 3){
-    ExecuteStringTxn(txn);
-  }
-  else if (txn->data_type_ == 4){
-    ExecuteBlogStringTxn(txn);
+  for (vector<Txn*>::iterator it = batch->begin(); it != batch->end(); ++it) {
+    applied_txns_.Push(*it);
   }
+  scheduler_event_.Notify();
 }
 
-void TxnProcessor::RunOCCScheduler() {
-  // CPSC 438/538:
-  //
-  // Implement this method!
-  //
-  // [For now, run serial scheduler in order to make it through the test
-  // suite]
-
-  Txn* txn;
-  bool validated;
+void TxnProcessor::RespondStage(vector<Txn*>* batch) {
+  for (vector<Txn*>::iterator it = batch->begin(); it != batch->end(); ++it) {
+    (*it)->status_ = COMMITTED;
+    txn_results_.Push(*it);
+  }
+}
 
-  while (tp_.Active()) {
+template <typename V>
+void TxnProcessor::ExecuteTxnParallelOf(Txn *txn) {
+  // Get the start time
+  txn->occ_start_time_ = GetTime();
 
-    //Get the next new transaction request (if one is pending) and pass it to an execution thread.
-    if (txn_requests_.Pop(&txn)) {
-      tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-            this,
-            &TxnProcessor::ExecuteOCCTxn,
-            txn));
+  // Txns up to 'start' have applied all their writes, so only txns that
+  // validate after it can have written anything this txn misses.
+  uint64 start = validation_ring_.Finished();
+
+  // Under MOCC a txn touching a hot record waits for its locks in key order,
+  // with the hot records it reads among them, and validates only the reads
+  // left optimistic.
+  vector<KeyLock> locks;
+  set<Key> optimistic;
+  KeySignature optimistic_signature;
+  const set<Key>* validated = &txn->readset_;
+  const KeySignature* signature = &txn->read_signature_;
+  if (mode_ == MOCC and MoccLocks(txn, &locks, &optimistic, &optimistic_signature)) {
+    for (vector<KeyLock>::iterator it = locks.begin(); it != locks.end(); ++it) {
+      if (it->mode_ == EXCLUSIVE) {
+        lm_->WriteLockBlocking(txn, it->key_);
+      } else {
+        lm_->ReadLockBlocking(txn, it->key_);
+      }
     }
-    
-    //Validation Phase:
-    // Process and commit all transactions that have finished running.
-    while (completed_txns_.Pop(&txn)) {
-      validated = true;
+    validated = &optimistic;
+    signature = &optimistic_signature;
 
-      // check all writes of the record to make sure it doesn't conflict with the current txn's readset/writeset
-      for (set<Key>::iterator it = txn->writeset_.begin();
-        it != txn->writeset_.end(); ++it) {
-        if ((storage_->Timestamp(*it)) > (txn->occ_start_time_)) {
-          validated  = false;
-        }
-      }
-      for (set<Key>::iterator it = txn->readset_.begin();
-        it != txn->readset_.end(); ++it) {
-        if ((storage_->Timestamp(*it)) > (txn->occ_start_time_)) {
-          validated  = false;
-        }
-      }
-      // Commit/abort txn according to program logic's commit/abort decision.
-      if (validated) {
-        // ApplyWrites(txn); 
-        if (txn->data_type_ == 1){
-          ApplyWrites(txn);
-        }
-        else if (txn->data_type_ == 2){
-          ApplyImageWrites(txn);
-        }
-        else if (txn->data_type_ == 3){
-          ApplyStringWrites(txn);
-        }
-        else if (txn->data_type_ == 4){
-          ApplyBlogStringWrites(txn);
-        }
-        txn->status_ = COMMITTED;
-        txn_results_.Push(txn);
-      } else  {
-        // Cleanup txn
-        txn->reads_.clear();
-        txn->writes_.clear();
-        txn->status_ = INCOMPLETE;
-        // Completely restart the transaction.
-        mutex_.Lock();
-        txn->unique_id_ = next_unique_id_;
-        next_unique_id_++;
-        txn_requests_.Push(txn);
-        mutex_.Unlock(); 
+    // the wait counts as before the txn started
+    txn->occ_start_time_ = GetTime();
+    start = validation_ring_.Finished();
+  } else {
+    // Request write locks as one batch. If they cannot all be granted at
+    // once, none are held.
+    locks.clear();
+    locks.reserve(txn->writeset_.size());
+    for (set<Key>::iterator it = txn->writeset_.begin();
+         it != txn->writeset_.end(); ++it) {
+      locks.push_back(KeyLock(*it, EXCLUSIVE));
+    }
+    // A txn denied any of them restarts, since the validation below only
+    // covers its reads and cannot catch a write made without the lock.
+    if (!lm_->AcquireAll(txn, locks, false)) {
+      if (mode_ == MOCC) {
+        MoccHeat(txn->writeset_);
       }
+      RestartTxn(txn);
+      return;
     }
   }
-}
-
-void TxnProcessor::ExecuteTxnParallel(Txn *txn) {
-    // Get the start time
-  txn->occ_start_time_ = GetTime();
- 
- 
-  bool blocked = false;
-  // Request write locks.
-    for (set<Key>::iterator it = txn->writeset_.begin();
-             it != txn->writeset_.end(); ++it) {
-      if (!lm_->WriteLock(txn, *it)) {
-        blocked = true;
-        // If writeset_.size() > 1, and blocked, just abort
-        if (txn->writeset_.size() > 1) {
-          // Release all write locks that already acquired
-          for (set<Key>::iterator it_writes = txn->writeset_.begin(); true; ++it_writes) {
-            lm_->Release(txn, *it_writes);
-            if (it_writes == it) {
-              break;
-            }
-          }
-          break;
-        }
-      }
-    }
- 
-      // If all write locks were immediately acquired, this txn is
-      // ready to be executed. Else, just restart the txn
-      /*if (blocked == false) {
-    if (lm_->ReadyExecute(txn)) {
-      ready_txns_.push_back(txn);
-    }
-      } else */if (blocked == true && (txn->writeset_.size() > 1)){
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock();
-    return;
-      }
 
- 
-  // Key *sortedWriteset = KeySorter(&(txn->writeset_));
- 
-  // for (uint64_t i = 0; i < txn->writeset_.size(); ++i) {
-  //   Key current = sortedWriteset[i];
-  //   while (!lm_->WriteLock(txn, current)) {
-  //     //continue;
-  //     sleep(1); // adjust this if necessary
-  //   }
-  // }
-
-  // free(sortedWriteset);
- 
   // Read everything in from readset.
   for (set<Key>::iterator it = txn->readset_.begin();
        it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Value result;
-    if (storage_->Read(*it, &result))
-      txn->reads_[*it] = result;
+    ReadRecordOf<V>(txn, *it);
   }
- 
+
   // Read everything in from writeset
   for (set<Key>::iterator it = txn->writeset_.begin();
        it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Value result;
-    if (storage_->Read(*it, &result))
-      txn->reads_[*it] = result;
+    ReadRecordOf<V>(txn, *it);
   }
- 
-  // Execute txn's program logic.
+
+  // Execute txn's program logic. A txn that decides to abort writes nothing,
+  // so it needs no validation.
   txn->Run();
- 
-  // critical section
-  // creates copy of active set and inserts the transaction
-  active_set_mutex_.Lock();
-  set<Txn *> active_set_copy_ = active_set_.GetSet();
-  active_set_.Insert(txn);
-  active_set_mutex_.Unlock();
- 
-  bool validTxn = true;
-  // Check times readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
-      it != txn->readset_.end(); ++it) {
-    if (storage_->Timestamp(*it) > txn->occ_start_time_) {
-      validTxn = false;
-      break;
-    }
+  if (txn->Status() == COMPLETED_A) {
+    lm_->ReleaseAll(txn, locks);
+    txn->status_ = ABORTED;
+    txn_results_.Push(txn);
+    return;
   }
- 
-  /********************
-  ** Don't need this part because writes are locked
- 
-  // Also read everything in from writeset.
+
+  // Publish the writeset, then check the writesets of the txns that began
+  // validating since this txn started.
+  uint64 seq = validation_ring_.Publish(txn->writeset_, txn->write_signature_,
+                                        txn->data_type_);
+  bool validTxn = !validation_ring_.Overlaps(start, seq, *validated,
+                                             *signature, txn->data_type_);
+
   if (validTxn) {
-    for (set<Key>::iterator it = txn->writeset_.begin();
-        it != txn->writeset_.end(); ++it) {
+    // apply writes
+    ApplyWritesOf<V>(txn);
+  } else if (mode_ == MOCC) {
+    // heat the records read that were overwritten meanwhile
+    set<Key> stale;
+    for (set<Key>::const_iterator it = validated->begin(); it != validated->end(); ++it) {
       if (storage_->Timestamp(*it) > txn->occ_start_time_) {
-        validTxn = false;
-        break;
-      }
-    }
-  }
- 
- *********************/
- 
-  // check all transactions in active set for overlaps
-  if (validTxn) {
-    for (set<Txn *>::iterator it = active_set_copy_.begin();
-        it != active_set_copy_.end(); ++it) {
-      if (txn->data_type_ == (*it)->data_type_) {
-        // check readset of each transaction
-        for (set<Key>::iterator txnIt = (*it)->writeset_.begin();
-            txnIt != (*it)->writeset_.end(); ++txnIt) {
-          if (txn->readset_.count(*txnIt) > 0) {
-            validTxn = false;
-            break;
-          }
-        }
+        stale.insert(*it);
       }
     }
+    MoccHeat(stale);
   }
- 
+  validation_ring_.Finish(seq);
+  lm_->ReleaseAll(txn, locks);
+
   if (validTxn) {
-    // apply writes
-    ApplyWrites(txn);
- 
-    // remove from active set (check if I need to obtain a lock on the entire active set table)
-    active_set_.Erase(txn);
-   
     // update commit status
     txn->status_ = COMMITTED;
- 
+
     // Return result to client.
     txn_results_.Push(txn);
   } else {
-    // remove from active set
-    active_set_.Erase(txn);
- 
     // cleanup txn
-    txn->reads_.clear();
-    txn->writes_.clear();
-    txn->status_ = INCOMPLETE;
- 
+    ResetTxn(txn);
+
     // restart txn
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock();
+    RestartTxn(txn);
   }
+}
 
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it) {
-    lm_->Release(txn, *it);
+bool TxnProcessor::MoccLocks(Txn* txn, vector<KeyLock>* locks,
+                             set<Key>* optimistic, KeySignature* signature) {
+  uint64 epoch = mocc_epoch_;
+  bool hot = false;
+  locks->clear();
+  optimistic->clear();
+  signature->Clear();
+
+  vector<KeyLock> all;
+  SortedLocks(txn, &all);
+  for (vector<KeyLock>::iterator it = all.begin(); it != all.end(); ++it) {
+    bool hot_key = MoccTemperature(LoadWord(storage_->TemperatureWord(it->key_)),
+                                   epoch) >= MOCC_HOT_TEMPERATURE;
+    hot = hot or hot_key;
+    if (it->mode_ == EXCLUSIVE or hot_key) {
+      locks->push_back(*it);
+    } else {
+      optimistic->insert(it->key_);
+      signature->Add(it->key_);
+    }
   }
-
+  return hot;
 }
- 
-void TxnProcessor::ExecuteTxnImageParallel(Txn *txn) {
-    // Get the start time
-  txn->occ_start_time_ = GetTime();
- 
 
-  bool blocked = false;
-  // Request write locks.
-    for (set<Key>::iterator it = txn->writeset_.begin();
-             it != txn->writeset_.end(); ++it) {
-      if (!lm_->WriteLock(txn, *it)) {
-        blocked = true;
-        // If writeset_.size() > 1, and blocked, just abort
-        if (txn->writeset_.size() > 1) {
-          // Release all write locks that already acquired
-          for (set<Key>::iterator it_writes = txn->writeset_.begin(); true; ++it_writes) {
-            lm_->Release(txn, *it_writes);
-            if (it_writes == it) {
-              break;
-            }
-          }
-          break;
-        }
+void TxnProcessor::MoccHeat(const set<Key>& keys) {
+  uint64 epoch = mocc_epoch_;
+  for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+    uint64* word = storage_->TemperatureWord(*it);
+    while (true) {
+      uint64 value = LoadWord(word);
+      uint64 heated = (epoch << MOCC_EPOCH_SHIFT) | (MoccTemperature(value, epoch) + 1);
+      if (__sync_bool_compare_and_swap(word, value, heated)) {
+        break;
       }
     }
- 
-      // If all write locks were immediately acquired, this txn is
-      // ready to be executed. Else, just restart the txn
-      /*if (blocked == false) {
-    if (lm_->ReadyExecute(txn)) {
-          std::cout << "check" << std::endl;
-      ready_txns_.push_back(txn);
-    }
-      } else */if (blocked == true && (txn->writeset_.size() > 1)){
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock();
-    return;
-      }
+  }
+}
 
- 
-  // Key *sortedWriteset = KeySorter(&(txn->writeset_));
- 
-  // for (uint64_t i = 0; i < txn->writeset_.size(); ++i) {
-  //   Key current = sortedWriteset[i];
-  //   while (!lm_->WriteLock(txn, current)) {
-  //     //continue;
-  //     sleep(1); // adjust this if necessary
-  //   }
- 
-  // }
+void TxnProcessor::RunOCCParallelScheduler() {
+  StartWorkers();
+
+  double epoch_start = GetTime();
+  while (!stopped_) {
+    ResubmitDelayedTxns();
+
+    // MOCC record temperatures halve every epoch, including the epochs
+    // this thread spent parked.
+    if (mode_ == MOCC and GetTime() >= epoch_start + MOCC_DECAY_INTERVAL) {
+      uint64 epochs = static_cast<uint64>((GetTime() - epoch_start) / MOCC_DECAY_INTERVAL);
+      __sync_fetch_and_add(&mocc_epoch_, epochs);
+      epoch_start += epochs * MOCC_DECAY_INTERVAL;
+    }
 
-  // free(sortedWriteset);
- 
-  // Read everything in from readset.
+    WaitForWork(false);
+  }
+}
+
+void TxnProcessor::RunSiloScheduler() {
+  StartWorkers();
+
+  double epoch_start = GetTime();
+  while (!stopped_) {
+    ResubmitDelayedTxns();
+
+    if (GetTime() >= epoch_start + SILO_EPOCH_DURATION) {
+      __sync_fetch_and_add(&silo_epoch_, 1);
+      epoch_start = GetTime();
+    }
+
+    WaitForWork(false);
+  }
+}
+
+void TxnProcessor::SiloRead(Txn* txn, Key key, uint64* tid) {
+  uint64* word = storage_->TidWord(key);
+  while (true) {
+    // wait out any commit in progress on the record
+    uint64 before = LoadWord(word);
+    if (before & SILO_LOCK_BIT) {
+      sched_yield();
+      continue;
+    }
+    __sync_synchronize();
+    ReadRecord(txn, key);
+
+    // the value is consistent iff no commit touched the record meanwhile
+    __sync_synchronize();
+    if (LoadWord(word) == before) {
+      *tid = before;
+      return;
+    }
+  }
+}
+
+void TxnProcessor::ExecuteSiloTxn(Txn* txn) {
+  // Read phase: read every record, remembering the TID of each version read.
+  // Keys are visited in order, so the TIDs line up with the sets.
+  vector<uint64> read_tids;
+  vector<uint64> write_tids;
+  read_tids.reserve(txn->readset_.size());
+  write_tids.reserve(txn->writeset_.size());
   for (set<Key>::iterator it = txn->readset_.begin();
        it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Image result;
-    if (storage_->ReadImage(*it, &result))
-      txn->readsIMG_[*it] = result;
+    uint64 tid;
+    SiloRead(txn, *it, &tid);
+    read_tids.push_back(tid);
   }
- 
-  // Read everything in from writeset
   for (set<Key>::iterator it = txn->writeset_.begin();
        it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    Image result;
-    if (storage_->ReadImage(*it, &result))
-      txn->readsIMG_[*it] = result;
+    uint64 tid;
+    SiloRead(txn, *it, &tid);
+    write_tids.push_back(tid);
   }
- 
-  // Execute txn's program logic.
+
+  // Execute txn's program logic. A txn that decides to abort writes nothing,
+  // so it needs no validation.
   txn->Run();
- 
-  // critical section
-  // creates copy of active set and inserts the transaction
-  active_set_mutex_.Lock();
-  set<Txn *> active_set_copy_ = active_set_.GetSet();
-  active_set_.Insert(txn);
-  active_set_mutex_.Unlock();
- 
-  bool validTxn = true;
-  // Check times readset.
+  if (txn->Status() == COMPLETED_A) {
+    txn->status_ = ABORTED;
+    txn_results_.Push(txn);
+    return;
+  }
+
+  // Commit phase 1: lock the writeset in key order, so committing txns never
+  // deadlock, then take the epoch the txn serializes in.
+  for (set<Key>::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it) {
+    LockWord(storage_->TidWord(*it), SILO_LOCK_BIT);
+  }
+  __sync_synchronize();
+  uint64 epoch = silo_epoch_;
+
+  // Commit phase 2: every record read must still hold the version read, and
+  // no other txn may be committing to one of them. A record the txn also
+  // writes carries its own lock bit.
+  bool validated = true;
+  uint64 tid = silo_worker_tid;
+  vector<uint64>::iterator seen = read_tids.begin();
   for (set<Key>::iterator it = txn->readset_.begin();
-      it != txn->readset_.end(); ++it) {
-    if (storage_->Timestamp(*it) > txn->occ_start_time_) {
-      validTxn = false;
-      break;
+       validated and it != txn->readset_.end(); ++it, ++seen) {
+    uint64 expected = *seen;
+    if (txn->writeset_.count(*it)) {
+      expected |= SILO_LOCK_BIT;
     }
-  }
- 
-  /********************
-  ** Don't need this part because writes are locked
- 
-  // Also read everything in from writeset.
-  if (validTxn) {
-    for (set<Key>::iterator it = txn->writeset_.begin();
-        it != txn->writeset_.end(); ++it) {
-      if (storage_->Timestamp(*it) > txn->occ_start_time_) {
-        validTxn = false;
-        break;
-      }
+    validated = (LoadWord(storage_->TidWord(*it)) == expected);
+    if (*seen > tid) {
+      tid = *seen;
     }
   }
- 
- *********************/
- 
-  // check all transactions in active set for overlaps
-  if (validTxn) {
-    for (set<Txn *>::iterator it = active_set_copy_.begin();
-        it != active_set_copy_.end(); ++it) {
-      if (txn->data_type_ == (*it)->data_type_) {
-        // check readset of each transaction
-        for (set<Key>::iterator txnIt = (*it)->writeset_.begin();
-            txnIt != (*it)->writeset_.end(); ++txnIt) {
-          if (txn->readset_.count(*txnIt) > 0) {
-            validTxn = false;
-            break;
-          }
-        }
-      }
+  seen = write_tids.begin();
+  for (set<Key>::iterator it = txn->writeset_.begin();
+       validated and it != txn->writeset_.end(); ++it, ++seen) {
+    validated = (LoadWord(storage_->TidWord(*it)) == (*seen | SILO_LOCK_BIT));
+    if (*seen > tid) {
+      tid = *seen;
     }
   }
- 
-  if (validTxn) {
-    // apply writes
-    ApplyImageWrites(txn);
- 
-    // remove from active set (check if I need to obtain a lock on the entire active set table)
-    active_set_.Erase(txn);
-   
-    // update commit status
-    txn->status_ = COMMITTED;
- 
-    // Return result to client.
-    txn_results_.Push(txn);
-  } else {
-    // remove from active set
-    active_set_.Erase(txn);
- 
+
+  if (!validated) {
+    for (set<Key>::iterator it = txn->writeset_.begin();
+         it != txn->writeset_.end(); ++it) {
+      __sync_fetch_and_and(storage_->TidWord(*it), ~static_cast<uint64>(SILO_LOCK_BIT));
+    }
+
     // cleanup txn
-    txn->reads_.clear();
-    txn->writes_.clear();
-    txn->status_ = INCOMPLETE;
- 
+    ResetTxn(txn);
+
     // restart txn
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock();
+    RestartTxn(txn);
+    return;
+  }
+
+  // Commit phase 3: the commit TID follows every TID the txn saw and every
+  // TID this worker chose before, within the txn's epoch. Writing it into
+  // the TID words after the new values publishes them and unlocks them.
+  tid += SILO_TID_STEP;
+  if (tid < (epoch << SILO_EPOCH_SHIFT)) {
+    tid = epoch << SILO_EPOCH_SHIFT;
   }
+  silo_worker_tid = tid;
+  ApplyWrites(txn);
+  __sync_synchronize();
   for (set<Key>::iterator it = txn->writeset_.begin();
        it != txn->writeset_.end(); ++it) {
-    lm_->Release(txn, *it);
+    *reinterpret_cast<volatile uint64*>(storage_->TidWord(*it)) = tid;
   }
+
+  // Return result to client.
+  txn->status_ = COMMITTED;
+  txn_results_.Push(txn);
 }
- 
-void TxnProcessor::ExecuteTxnStringParallel(Txn *txn) {
-    // Get the start time
-  txn->occ_start_time_ = GetTime();
- 
 
-  bool blocked = false;
-  // Request write locks.
-    for (set<Key>::iterator it = txn->writeset_.begin();
-             it != txn->writeset_.end(); ++it) {
-      if (!lm_->WriteLock(txn, *it)) {
-        blocked = true;
-        // If writeset_.size() > 1, and blocked, just abort
-        if (txn->writeset_.size() > 1) {
-          // Release all write locks that already acquired
-          for (set<Key>::iterator it_writes = txn->writeset_.begin(); true; ++it_writes) {
-            lm_->Release(txn, *it_writes);
-            if (it_writes == it) {
-              break;
-            }
-          }
-          break;
+void TxnProcessor::RunAdaptiveScheduler() {
+  Txn* txn;
+  vector<KeyLock> locks;
+
+  // The protocol running, and the one to switch to once every txn admitted
+  // under it has finished (the same unless a switch is under way).
+  CCMode phase = SILO;
+  CCMode next = SILO;
+  double drain_start = 0;
+
+  // Txns handed to SILO workers, and txns admitted under LOCKING that have
+  // not finished yet.
+  uint64 dispatched = adaptive_done_;
+  uint64 in_flight = 0;
+
+  RetryStats stats;
+  GetRetryStats(&stats);
+  uint64 restarts = stats.restarts_;
+  uint64 silo_done = adaptive_done_;
+  double epoch_start = GetTime();
+  AdaptiveWindow window(epoch_start, phase);
+
+  while (!stopped_) {
+    ResubmitDelayedTxns();
+    bool busy = false;
+
+    if (GetTime() >= epoch_start + SILO_EPOCH_DURATION) {
+      __sync_fetch_and_add(&silo_epoch_, 1);
+      epoch_start = GetTime();
+    }
+
+    // Admit the next txn request, unless switching.
+    if (next == phase and txn_requests_.Pop(&txn)) {
+      busy = true;
+      if (phase == SILO) {
+        dispatched++;
+        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
+              this,
+              &TxnProcessor::ExecuteAdaptiveSiloTxn,
+              txn));
+      } else {
+        // As under LOCKING, but timing how long the txn waits for its locks.
+        in_flight++;
+        txn->occ_start_time_ = GetTime();
+        SortedLocks(txn, &locks);
+        bool wait = (locks.size() <= 1);
+        if (lm_->AcquireAll(txn, locks, wait)) {
+          ready_txns_.push_back(txn);
+        } else if (!wait) {
+          in_flight--;
+          RestartTxn(txn);
         }
       }
     }
- 
-      // If all write locks were immediately acquired, this txn is
-      // ready to be executed. Else, just restart the txn
-      /*if (blocked == false) {
-    if (lm_->ReadyExecute(txn)) {
-      ready_txns_.push_back(txn);
-    }
-      } else */if (blocked == true && (txn->writeset_.size() > 1)){
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock();
-    return;
+
+    if (phase == LOCKING) {
+      // Process and commit all transactions that have finished running.
+      while (completed_txns_.Pop(&txn)) {
+        busy = true;
+        if (txn->Status() == COMPLETED_C) {
+          ApplyWrites(txn);
+          txn->status_ = COMMITTED;
+        } else if (txn->Status() == COMPLETED_A) {
+          txn->status_ = ABORTED;
+        } else {
+          // Invalid TxnStatus!
+          DIE("Completed Txn has invalid TxnStatus: " << txn->Status());
+        }
+
+        // Release all locks.
+        SortedLocks(txn, &locks);
+        lm_->ReleaseAll(txn, locks);
+        in_flight--;
+        window.finished_++;
+
+        // Return result to client.
+        txn_results_.Push(txn);
       }
 
- 
-  // Key *sortedWriteset = KeySorter(&(txn->writeset_));
- 
-  // for (uint64_t i = 0; i < txn->writeset_.size(); ++i) {
-  //   Key current = sortedWriteset[i];
-  //   while (!lm_->WriteLock(txn, current)) {
-  //     //continue;
-  //     sleep(1); // adjust this if necessary
-  //   }
-  // }
-
-  // free(sortedWriteset);
- 
-  // Read everything in from readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
-       it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    String result;
-    if (storage_->ReadString(*it, &result))
-      txn->readsSTR_[*it] = result;
-  }
- 
-  // Read everything in from writeset
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    String result;
-    if (storage_->ReadString(*it, &result))
-      txn->readsSTR_[*it] = result;
-  }
- 
-  // Execute txn's program logic.
-  txn->Run();
- 
-  // critical section
-  // creates copy of active set and inserts the transaction
-  active_set_mutex_.Lock();
-  set<Txn *> active_set_copy_ = active_set_.GetSet();
-  active_set_.Insert(txn);
-  active_set_mutex_.Unlock();
- 
-  bool validTxn = true;
-  // Check times readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
-      it != txn->readset_.end(); ++it) {
-    if (storage_->Timestamp(*it) > txn->occ_start_time_) {
-      validTxn = false;
-      break;
-    }
-  }
- 
-  /********************
-  ** Don't need this part because writes are locked
- 
-  // Also read everything in from writeset.
-  if (validTxn) {
-    for (set<Key>::iterator it = txn->writeset_.begin();
-        it != txn->writeset_.end(); ++it) {
-      if (storage_->Timestamp(*it) > txn->occ_start_time_) {
-        validTxn = false;
-        break;
+      // Start executing all transactions that have newly acquired all their
+      // locks.
+      while (ready_txns_.size()) {
+        txn = ready_txns_.front();
+        ready_txns_.pop_front();
+        busy = true;
+        window.lock_wait_ += GetTime() - txn->occ_start_time_;
+
+        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
+              this,
+              KernelsFor(txn).execute_,
+              txn));
       }
     }
-  }
- 
- *********************/
- 
-  // check all transactions in active set for overlaps
-  if (validTxn) {
-    for (set<Txn *>::iterator it = active_set_copy_.begin();
-        it != active_set_copy_.end(); ++it) {
-      if (txn->data_type_ == (*it)->data_type_) {
-        // check readset of each transaction
-        for (set<Key>::iterator txnIt = (*it)->writeset_.begin();
-            txnIt != (*it)->writeset_.end(); ++txnIt) {
-          if (txn->readset_.count(*txnIt) > 0) {
-            validTxn = false;
-            break;
-          }
+
+    // The old protocol is drained once none of its txns is left running.
+    bool drained = (next != phase) and
+        (phase == SILO ? adaptive_done_ == dispatched : in_flight == 0);
+    double now = GetTime();
+    if (!drained and now < window.start_ + ADAPTIVE_WINDOW) {
+      // requests wait out a switch, so only finishing txns wake a drain
+      WaitForWork(busy, next == phase);
+      continue;
+    }
+
+    // Close the window. A SILO txn that reached the end of an attempt either
+    // finished or was restarted.
+    GetRetryStats(&stats);
+    window.restarts_ = stats.restarts_ - restarts;
+    restarts = stats.restarts_;
+    if (phase == SILO) {
+      uint64 done = adaptive_done_;
+      uint64 attempts = done - silo_done;
+      silo_done = done;
+      window.finished_ = (attempts > window.restarts_) ? attempts - window.restarts_ : 0;
+    }
+    window.length_ = now - window.start_;
+    adaptive_mutex_.Lock();
+    adaptive_windows_.push_back(window);
+    if (drained) {
+      adaptive_switches_.push_back(AdaptiveSwitch(now, phase, next, now - drain_start));
+      phase = next;
+    }
+    adaptive_mutex_.Unlock();
+
+    // Unless switching already, decide over the latest ADAPTIVE_SLIDE
+    // windows, if the current protocol has run that long.
+    if (!drained and next == phase) {
+      int windows = 0;
+      uint64 finished = 0;
+      uint64 restarted = 0;
+      double lock_wait = 0;
+      for (vector<AdaptiveWindow>::reverse_iterator it = adaptive_windows_.rbegin();
+           windows < ADAPTIVE_SLIDE and it != adaptive_windows_.rend() and
+           it->mode_ == phase; ++it, ++windows) {
+        finished += it->finished_;
+        restarted += it->restarts_;
+        lock_wait += it->lock_wait_;
+      }
+
+      uint64 attempts = finished + restarted;
+      if (windows == ADAPTIVE_SLIDE and attempts >= ADAPTIVE_MIN_ATTEMPTS) {
+        double abort_rate = static_cast<double>(restarted) / attempts;
+        if (phase == SILO and abort_rate >= ADAPTIVE_ABORT_HIGH) {
+          next = LOCKING;
+        } else if (phase == LOCKING and abort_rate < ADAPTIVE_ABORT_LOW and
+                   lock_wait / attempts < ADAPTIVE_WAIT_LOW) {
+          next = SILO;
         }
+        drain_start = now;
       }
     }
+
+    window = AdaptiveWindow(now, phase);
   }
- 
-  if (validTxn) {
-    // apply writes
-    ApplyStringWrites(txn);
- 
-    // remove from active set (check if I need to obtain a lock on the entire active set table)
-    active_set_.Erase(txn);
-   
-    // update commit status
-    txn->status_ = COMMITTED;
- 
-    // Return result to client.
-    txn_results_.Push(txn);
-  } else {
-    // remove from active set
-    active_set_.Erase(txn);
- 
-    // cleanup txn
-    txn->reads_.clear();
-    txn->writes_.clear();
-    txn->status_ = INCOMPLETE;
- 
-    // restart txn
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock();
-  }
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it) {
-    lm_->Release(txn, *it);
+}
+
+void TxnProcessor::ExecuteAdaptiveSiloTxn(Txn* txn) {
+  // the txn may be freed by the client as soon as it is returned, so it is
+  // counted without being looked at
+  ExecuteSiloTxn(txn);
+  __sync_fetch_and_add(&adaptive_done_, 1);
+
+  // the scheduler may be parked waiting for SILO to drain
+  scheduler_event_.Notify();
+}
+
+void TxnProcessor::RunTicTocScheduler() {
+  StartWorkers();
+
+  while (!stopped_) {
+    ResubmitDelayedTxns();
+    WaitForWork(false);
   }
 }
- 
-void TxnProcessor::ExecuteTxnBlogStringParallel(Txn *txn) {
-    // Get the start time
-  txn->occ_start_time_ = GetTime();
- 
 
-  bool blocked = false;
-  // Request write locks.
-    for (set<Key>::iterator it = txn->writeset_.begin();
-             it != txn->writeset_.end(); ++it) {
-      if (!lm_->WriteLock(txn, *it)) {
-        blocked = true;
-        // If writeset_.size() > 1, and blocked, just abort
-        if (txn->writeset_.size() > 1) {
-          // Release all write locks that already acquired
-          for (set<Key>::iterator it_writes = txn->writeset_.begin(); true; ++it_writes) {
-            lm_->Release(txn, *it_writes);
-            if (it_writes == it) {
-              break;
-            }
-          }
-          break;
-        }
-      }
+void TxnProcessor::TicTocRead(Txn* txn, Key key, uint64* wts, uint64* rts) {
+  uint64* word = storage_->TicTocWord(key);
+  while (true) {
+    // wait out any commit in progress on the record
+    uint64 before = LoadWord(word);
+    if (before & TICTOC_LOCK_BIT) {
+      sched_yield();
+      continue;
     }
- 
-      // If all write locks were immediately acquired, this txn is
-      // ready to be executed. Else, just restart the txn
-      /*if (blocked == false) {
-    if (lm_->ReadyExecute(txn)) {
-      ready_txns_.push_back(txn);
-    }
-      } else */if (blocked == true && (txn->writeset_.size() > 1)){
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock();
-    return;
-      }
+    __sync_synchronize();
+    ReadRecord(txn, key);
+
+    // the value is consistent iff no commit wrote the record meanwhile;
+    // readers extending rts do not matter
+    __sync_synchronize();
+    uint64 after = LoadWord(word);
+    if (!(after & TICTOC_LOCK_BIT) and TicTocWts(after) == TicTocWts(before)) {
+      *wts = TicTocWts(after);
+      *rts = TicTocRts(after);
+      return;
+    }
+  }
+}
 
- 
-  // Key *sortedWriteset = KeySorter(&(txn->writeset_));
- 
-  // for (uint64_t i = 0; i < txn->writeset_.size(); ++i) {
-  //   Key current = sortedWriteset[i];
-  //   while (!lm_->WriteLock(txn, current)) {
-  //     //continue;
-  //     sleep(1); // adjust this if necessary
-  //   }
-  // }
-
-  // free(sortedWriteset);
- 
-  // Read everything in from readset.
+void TxnProcessor::ExecuteTicTocTxn(Txn* txn) {
+  // Read phase: read every record, remembering the timestamps of each
+  // version read. Keys are visited in order, so they line up with the sets.
+  vector<uint64> read_wts, read_rts, write_wts;
+  read_wts.reserve(txn->readset_.size());
+  read_rts.reserve(txn->readset_.size());
+  write_wts.reserve(txn->writeset_.size());
   for (set<Key>::iterator it = txn->readset_.begin();
        it != txn->readset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    BlogString result;
-    if (storage_->ReadBlogString(*it, &result))
-      txn->readsBSTR_[*it] = result;
+    uint64 wts, rts;
+    TicTocRead(txn, *it, &wts, &rts);
+    read_wts.push_back(wts);
+    read_rts.push_back(rts);
   }
- 
-  // Read everything in from writeset
   for (set<Key>::iterator it = txn->writeset_.begin();
        it != txn->writeset_.end(); ++it) {
-    // Save each read result iff record exists in storage.
-    BlogString result;
-    if (storage_->ReadBlogString(*it, &result))
-      txn->readsBSTR_[*it] = result;
+    uint64 wts, rts;
+    TicTocRead(txn, *it, &wts, &rts);
+    write_wts.push_back(wts);
   }
- 
-  // Execute txn's program logic.
+
+  // Execute txn's program logic. A txn that decides to abort writes nothing,
+  // so it needs no validation.
   txn->Run();
- 
-  // critical section
-  // creates copy of active set and inserts the transaction
-  active_set_mutex_.Lock();
-  set<Txn *> active_set_copy_ = active_set_.GetSet();
-  active_set_.Insert(txn);
-  active_set_mutex_.Unlock();
- 
-  bool validTxn = true;
-  // Check times readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
-      it != txn->readset_.end(); ++it) {
-    if (storage_->Timestamp(*it) > txn->occ_start_time_) {
-      validTxn = false;
-      break;
+  if (txn->Status() == COMPLETED_A) {
+    txn->status_ = ABORTED;
+    txn_results_.Push(txn);
+    return;
+  }
+
+  // Lock the writeset in key order, so committing txns never deadlock. The
+  // commit timestamp must follow every read of the records written, and
+  // must not precede the versions read.
+  bool validated = true;
+  uint64 commit_ts = 0;
+  vector<uint64>::iterator seen = write_wts.begin();
+  for (set<Key>::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it, ++seen) {
+    uint64 word = LockWord(storage_->TicTocWord(*it), TICTOC_LOCK_BIT);
+    if (TicTocWts(word) != *seen) {
+      validated = false;
+    }
+    if (TicTocRts(word) + 1 > commit_ts) {
+      commit_ts = TicTocRts(word) + 1;
     }
   }
- 
-  /********************
-  ** Don't need this part because writes are locked
- 
-  // Also read everything in from writeset.
-  if (validTxn) {
-    for (set<Key>::iterator it = txn->writeset_.begin();
-        it != txn->writeset_.end(); ++it) {
-      if (storage_->Timestamp(*it) > txn->occ_start_time_) {
-        validTxn = false;
-        break;
-      }
+  for (vector<uint64>::iterator wts = read_wts.begin(); wts != read_wts.end(); ++wts) {
+    if (*wts > commit_ts) {
+      commit_ts = *wts;
     }
   }
- 
- *********************/
- 
-  // check all transactions in active set for overlaps
-  if (validTxn) {
-    for (set<Txn *>::iterator it = active_set_copy_.begin();
-        it != active_set_copy_.end(); ++it) {
-      if (txn->data_type_ == (*it)->data_type_) {
-        // check readset of each transaction
-        for (set<Key>::iterator txnIt = (*it)->writeset_.begin();
-            txnIt != (*it)->writeset_.end(); ++txnIt) {
-          if (txn->readset_.count(*txnIt) > 0) {
-            validTxn = false;
-            break;
-          }
-        }
+
+  // Every version read must still be valid at commit_ts. Versions known
+  // valid that long need no check; otherwise the version must not have been
+  // replaced (or be about to be), and its rts is extended to commit_ts. A
+  // record the txn also writes is locked by the txn itself, and its new
+  // version starts at commit_ts, so only the version is checked.
+  seen = read_wts.begin();
+  vector<uint64>::iterator valid = read_rts.begin();
+  for (set<Key>::iterator it = txn->readset_.begin();
+       validated and it != txn->readset_.end(); ++it, ++seen, ++valid) {
+    if (*valid >= commit_ts) {
+      continue;
+    }
+    bool written = txn->writeset_.count(*it) > 0;
+    uint64* word = storage_->TicTocWord(*it);
+    while (true) {
+      uint64 current = LoadWord(word);
+      if (TicTocWts(current) != *seen or
+          (!written and (current & TICTOC_LOCK_BIT))) {
+        validated = false;
+        break;
+      }
+      if (written or TicTocRts(current) >= commit_ts or
+          __sync_bool_compare_and_swap(word, current,
+                                       TicTocPack(TicTocWts(current), commit_ts))) {
+        break;
       }
     }
   }
- 
-  if (validTxn) {
-    // apply writes
-    ApplyBlogStringWrites(txn);
- 
-    // remove from active set (check if I need to obtain a lock on the entire active set table)
-    active_set_.Erase(txn);
-   
-    // update commit status
-    txn->status_ = COMMITTED;
- 
-    // Return result to client.
-    txn_results_.Push(txn);
-  } else {
-    // remove from active set
-    active_set_.Erase(txn);
- 
+
+  if (!validated) {
+    for (set<Key>::iterator it = txn->writeset_.begin();
+         it != txn->writeset_.end(); ++it) {
+      __sync_fetch_and_and(storage_->TicTocWord(*it), ~TICTOC_LOCK_BIT);
+    }
+
     // cleanup txn
-    txn->reads_.clear();
-    txn->writes_.clear();
-    txn->status_ = INCOMPLETE;
- 
+    ResetTxn(txn);
+
     // restart txn
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock();
+    RestartTxn(txn);
+    return;
   }
+
+  // Install the writes as versions valid from commit_ts; writing the new
+  // timestamp words publishes them and unlocks them.
+  ApplyWrites(txn);
+  __sync_synchronize();
   for (set<Key>::iterator it = txn->writeset_.begin();
        it != txn->writeset_.end(); ++it) {
-    lm_->Release(txn, *it);
+    *reinterpret_cast<volatile uint64*>(storage_->TicTocWord(*it)) =
+        TicTocPack(commit_ts, commit_ts);
   }
-}
 
- 
-void TxnProcessor::RunOCCParallelScheduler() {
-  // CPSC 438/538:
-  //
-  // Implement this method! Note that implementing OCC with parallel
-  // validation may need to create another method, like
-  // TxnProcessor::ExecuteTxnParallel.
-  // Note that you can use active_set_ and active_set_mutex_ we provided
-  // for you in the txn_processor.h
-  //
-  // [For now, run serial scheduler in order to make it through the test
-  // suite]
- 
-  Txn* txn;
-  while (tp_.Active()) {
-    // Get next txn request.
-    if (txn_requests_.Pop(&txn)) {
-      // Start txn running in its own thread.
-      if(txn->data_type_ == 1) {
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-              this,
-              &TxnProcessor::ExecuteTxnParallel,
-              txn));
-      } else if(txn->data_type_ == 2) {
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-              this,
-              &TxnProcessor::ExecuteTxnImageParallel,
-              txn));
-      } else if(txn->data_type_ == 3) {
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-              this,
-              &TxnProcessor::ExecuteTxnStringParallel,
-              txn));
-      } else if(txn->data_type_ == 4) {
-        tp_.RunTask(new Method<TxnProcessor, void, Txn*>(
-              this,
-              &TxnProcessor::ExecuteTxnBlogStringParallel,
-              txn));
-      }
-    }
-  }
+  // Return result to client.
+  txn->status_ = COMMITTED;
+  txn_results_.Push(txn);
 }
 
-
 void TxnProcessor::RunMVCCScheduler() {
   // CPSC 438/538:
   //
@@ -5,24 +5,34 @@
 #ifndef _TXN_PROCESSOR_H_
 #define _TXN_PROCESSOR_H_
 
+#include <algorithm>
 #include <deque>
+#include <functional>
 #include <map>
+#include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "txn/common.h"
 #include "txn/lock_manager.h"
 #include "txn/storage.h"
 #include "txn/mvcc_storage.h"
+#include "txn/procedure.h"
 #include "txn/txn.h"
+#include "txn/validation_ring.h"
 #include "utils/atomic.h"
 #include "utils/static_thread_pool.h"
 #include "utils/mutex.h"
 #include "utils/condition.h"
+#include "utils/event_count.h"
 
 
 using std::deque;
+using std::greater;
 using std::map;
+using std::pair;
+using std::priority_queue;
 using std::string;
 
 // The TxnProcessor supports five different execution modes, corresponding to
@@ -36,17 +46,70 @@ enum CCMode {
   MVCC = 5,
   TWOPL = 6,                     // Final Project 2PL
   TWOPL2 = 7,
-  SILO = 8,
+  SILO = 8,                    // OCC over per-record TID words (Silo)
+  CALVIN = 9,                  // Deterministic locking over batched epochs
+  VLL = 10,                    // Very lightweight locking (request counters)
+  TICTOC = 11,                 // OCC with per-record data-driven timestamps
+  ADAPTIVE = 12,               // Switches between SILO and LOCKING at runtime
+  MOCC = 13,                   // P_OCC that locks records it often aborts on
 };
 
 // Returns a human-readable string naming of the providing mode.
 string ModeToString(CCMode mode);
 
+// Counters kept by the modes that restart aborted txns (LOCKING_EXCLUSIVE_ONLY,
+// LOCKING, OCC, P_OCC and SILO).
+struct RetryStats {
+  RetryStats() : restarts_(0), abandoned_(0), backoff_(0), max_retries_(0) {}
+  uint64 restarts_;   // Restarts scheduled.
+  uint64 abandoned_;  // Txns returned ABORTED after exceeding the retry limit.
+  double backoff_;    // Total backoff delay scheduled, in seconds.
+  int max_retries_;   // Most restarts of any one txn.
+};
+
+// What the ADAPTIVE scheduler observed over one of its windows.
+struct AdaptiveWindow {
+  AdaptiveWindow(double start, CCMode mode)
+      : start_(start), length_(0), mode_(mode), finished_(0), restarts_(0),
+        lock_wait_(0) {}
+  double start_;      // Start time of the window.
+  double length_;     // Length of the window in seconds.
+  CCMode mode_;       // Protocol running (SILO or LOCKING).
+  uint64 finished_;   // Txns returned to the client.
+  uint64 restarts_;   // Txns restarted.
+  double lock_wait_;  // Total time txns waited for locks, in seconds.
+};
+
+// A switch of protocol by the ADAPTIVE scheduler.
+struct AdaptiveSwitch {
+  AdaptiveSwitch(double time, CCMode from, CCMode to, double drain)
+      : time_(time), from_(from), to_(to), drain_(drain) {}
+  double time_;   // When the new protocol started running.
+  CCMode from_;
+  CCMode to_;
+  double drain_;  // Seconds spent waiting for the old protocol's txns.
+};
+
+// Occupancy of one stage of OCC's commit pipeline.
+struct CommitStageStats {
+  CommitStageStats(const string& name, int workers)
+      : name_(name), workers_(workers), txns_(0), batches_(0), busy_(0),
+        max_queued_(0), occupancy_(0) {}
+  string name_;       // "execute", "validate", "apply" or "respond".
+  int workers_;       // Threads running the stage.
+  uint64 txns_;       // Txns processed.
+  uint64 batches_;    // Batches processed, so txns_ / batches_ is their size.
+  double busy_;       // Total seconds its threads spent processing.
+  uint64 max_queued_; // Longest backlog a batch was taken from.
+  double occupancy_;  // busy_ over workers_ times the seconds it has run.
+};
+
 class TxnProcessor {
  public:
   // The TxnProcessor's constructor starts the TxnProcessor running in the
-  // background.
-  explicit TxnProcessor(CCMode mode);
+  // background. 'policy' selects how TWOPL handles lock conflicts and is
+  // ignored by every other mode.
+  explicit TxnProcessor(CCMode mode, DeadlockPolicy policy = NO_WAIT);
 
   // The TxnProcessor's destructor stops all background threads and deallocates
   // all objects currently owned by the TxnProcessor, except for Txn objects.
@@ -56,6 +119,13 @@ class TxnProcessor {
   // Ownership of '*txn' is transfered to the TxnProcessor.
   void NewTxnRequest(Txn* txn);
 
+  // Registers a call of stored procedure 'id' of 'registry' with 'params',
+  // run in a context pooled by the registry. Its result is returned by
+  // GetTxnResult() like any other, and the caller hands it back with
+  // registry->Recycle() instead of deleting it.
+  void NewProcedureRequest(ProcedureRegistry* registry, int id,
+                           const ProcedureParams& params);
+
   // Returns a pointer to the next COMMITTED or ABORTED Txn. The caller takes
   // ownership of the returned Txn.
   Txn* GetTxnResult();
@@ -63,16 +133,82 @@ class TxnProcessor {
   // Main loop implementing all concurrency control/thread scheduling.
   void RunScheduler();
 
+  // If the mode handles deadlocks (TWOPL by prevention, TWOPL2 by detection),
+  // sets '*stats' to its counters and returns true, else returns false.
+  bool GetDeadlockStats(DeadlockStats* stats);
+
+  // Returns the contention profiler of the mode's lock manager, or NULL if
+  // the mode has none.
+  LockProfiler* GetLockProfiler();
+
+  // Sets how many times an aborted txn is restarted before it is returned to
+  // the client ABORTED instead. A negative limit means no limit.
+  void SetMaxRetries(int max_retries);
+
+  // Sets '*stats' to the restart counters.
+  void GetRetryStats(RetryStats* stats);
+
+  // Sets '*stages' to the occupancy of each stage of OCC's commit pipeline,
+  // in pipeline order. The bottleneck is the stage nearest full occupancy,
+  // with the longest backlog (the pool's backlog is not tracked, so execute
+  // reports none). No other mode has a pipeline or any stages.
+  void GetCommitStages(vector<CommitStageStats>* stages);
+
+  // Sets '*windows' to the ADAPTIVE scheduler's windows so far, oldest
+  // first, and '*switches' to its protocol switches.
+  void GetAdaptiveLog(vector<AdaptiveWindow>* windows,
+                      vector<AdaptiveSwitch>* switches);
+
   
   static void* StartScheduler(void * arg);
   
  private:
 
-  // Parallel execution/validation for OCC
-  void ExecuteTxnParallel(Txn *txn);
-  void ExecuteTxnImageParallel(Txn *txn);
-  void ExecuteTxnStringParallel(Txn *txn);
-  void ExecuteTxnBlogStringParallel(Txn *txn);
+  // Type-generic execution kernels, one instance per record type V (Value,
+  // Image, String or BlogString), which reads and writes a txn's maps for
+  // that type and the matching Storage calls.
+  //
+  // Performs all reads required to execute the transaction, then executes
+  // the transaction logic.
+  template <typename V> void ExecuteTxnOf(Txn* txn);
+
+  // Parallel execution/validation for OCC (P_OCC and MOCC)
+  template <typename V> void ExecuteTxnParallelOf(Txn* txn);
+
+  // Applies all writes performed by '*txn' to 'storage_'.
+  //
+  // Requires: txn->Status() is COMPLETED_C.
+  template <typename V> void ApplyWritesOf(Txn* txn);
+
+  // Reads the record 'key' from storage into txn's reads.
+  template <typename V> void ReadRecordOf(Txn* txn, Key key);
+
+  // Reads the record 'key' into txn's reads and writes it straight back, as
+  // TWOPL2 does with each record it write locks.
+  template <typename V> void RewriteRecordOf(Txn* txn, Key key);
+
+  // Txn's maps and storage calls for record type V.
+  template <typename V> static map<Key, V>* ReadsOf(Txn* txn);
+  template <typename V> static map<Key, V>* WritesOf(Txn* txn);
+  template <typename V> bool StorageRead(Key key, V* result);
+  template <typename V> void StorageWrite(Key key, const V& value, int id);
+
+  // The kernels for one record type. A txn's kernels are looked up by its
+  // data type once, when it is dispatched, rather than branched on at every
+  // step.
+  struct Kernels {
+    void (TxnProcessor::*execute_)(Txn*);
+    void (TxnProcessor::*execute_parallel_)(Txn*);
+    void (TxnProcessor::*apply_writes_)(Txn*);
+    void (TxnProcessor::*read_record_)(Txn*, Key);
+    void (TxnProcessor::*rewrite_record_)(Txn*, Key);
+  };
+
+  // Kernels indexed by data type.
+  static const Kernels kernels_[];
+
+  // Returns the kernels for txn's data type.
+  static const Kernels& KernelsFor(Txn* txn);
 
   
   Key* KeySorter(set<Key>* set);
@@ -81,8 +217,24 @@ class TxnProcessor {
   // Serial validation
   bool SerialValidate(Txn *txn);
 
-  // Parallel executtion/validation for OCC
-  // void ExecuteTxnParallel(Txn *txn);
+  // Restarts an aborted txn: after a randomized backoff that doubles with
+  // each retry of the txn, it is resubmitted with a new unique_id_. Once it
+  // has been retried 'max_retries_' times it is returned to the client
+  // ABORTED instead. Safe to call from any thread.
+  void RestartTxn(Txn* txn);
+
+  // Called by the scheduler loops of LOCKING, OCC, ADAPTIVE and the
+  // run-to-completion modes at the end of each pass, saying whether the pass
+  // found any work. After 'spin_limit_' idle passes in a row it parks the
+  // scheduler thread until a txn is requested or completes or a restarted
+  // txn is due. A scheduler not 'admitting' requests is not woken by them.
+  // The limit doubles when work turns up while spinning and halves when the
+  // thread parks.
+  void WaitForWork(bool busy, bool admitting = true);
+
+  // Resubmits every restarted txn whose backoff has expired. Called from the
+  // scheduler loops of the modes that use RestartTxn().
+  void ResubmitDelayedTxns();
 
   // Serial version of scheduler.
   void RunSerialScheduler();
@@ -97,11 +249,181 @@ class TxnProcessor {
   // Locking version of scheduler.
   void RunLockingScheduler();
 
-  // OCC version of scheduler.
+  // Deterministic locking scheduler (CALVIN). Incoming requests are sequenced
+  // into epochs, and each epoch's txns request all of their locks in sequence
+  // order, so txns never deadlock and never abort. Lock requests are fanned
+  // out to CALVIN_LOCK_THREADS lock manager threads, one per key partition.
+  void RunCalvinScheduler();
+
+  // Very lightweight locking scheduler (VLL). Instead of lock queues, every
+  // record keeps a count of queued txns that will write it and that will read
+  // it. A txn arriving to find only itself counted on its records runs at
+  // once; otherwise it is blocked, and is unblocked once no txn ahead of it
+  // in the VLL queue touches its records.
+  void RunVLLScheduler();
+
+  // OCC version of scheduler. Commit is a pipeline of stages: txns are
+  // executed by the pool, validated serially by the scheduler thread in
+  // batches of up to OCC_VALIDATION_BATCH, then have their writes installed
+  // by 'apply_stage_' and are returned by 'respond_stage_'. Until its writes
+  // are installed a validated txn's writeset is in flight, and any txn
+  // touching it fails validation. There is no log to force, so no log stage;
+  // one would run between apply and respond.
   void RunOCCScheduler();
 
-  // OCC version of scheduler with parallel validation.
+  // A stage of OCC's commit pipeline after validation: the txns queued for
+  // it, the notifier its idle threads park on, and each thread's batch and
+  // counters. 'process_' handles a batch of up to 'batch_' txns. A stage
+  // with no 'workers_' of its own is run by the scheduler thread as soon as
+  // txns are queued for it.
+  struct CommitStage {
+    CommitStage(const string& name, int workers, int batch,
+                void (TxnProcessor::*process)(vector<Txn*>*))
+        : workers_(workers), batch_(batch), process_(process),
+          batches_(std::max(workers, 1)),
+          stats_(std::max(workers, 1), CommitStageStats(name, 1)) {}
+    AtomicQueue<Txn*> queue_;
+    EventCount event_;
+    int workers_;
+    int batch_;
+    void (TxnProcessor::*process_)(vector<Txn*>*);
+    vector<vector<Txn*> > batches_;
+    vector<CommitStageStats> stats_;
+  };
+
+  // Creates OCC's apply and respond stages and starts their threads.
+  void StartCommitStages();
+
+  // Wakes the threads of 'stage', or runs it on this thread if it has none.
+  void HandOff(CommitStage* stage);
+
+  // Takes a batch off the queue of 'stage' and processes it as 'worker'.
+  // Returns false if the queue was empty.
+  bool ProcessStage(CommitStage* stage, int worker);
+
+  // Loop of thread 'worker' of 'stage', until the processor stops.
+  void RunCommitStage(CommitStage* stage, int worker);
+
+  // Installs the writes of a batch of validated txns, then hands them back
+  // to the scheduler thread through 'applied_txns_'.
+  void ApplyStage(vector<Txn*>* batch);
+
+  // Marks a batch of txns COMMITTED and returns them to the client.
+  void RespondStage(vector<Txn*>* batch);
+
+  // True for the run-to-completion modes (P_OCC, MOCC, SILO and TICTOC).
+  // Every thread of the pool runs RunWorker(), taking txn requests straight
+  // from 'request_shards_' and executing, validating and committing each
+  // inline. The scheduler thread only resubmits restarted txns and keeps
+  // time (epochs).
+  bool RunsToCompletion();
+
+  // True for the locking modes that release locks early
+  // (LOCKING_EXCLUSIVE_ONLY, LOCKING and TWOPL). A worker installs a
+  // committing txn's writes itself, while it still holds the txn's locks,
+  // and the scheduler releases them as soon as the txn completes. The txn's
+  // result is returned only after every txn whose writes it may have read
+  // has been (see LockManager::ReleaseEarly).
+  bool ReleasesLocksEarly();
+
+  // Releases the locks of completed 'txn' early, and commits it unless it
+  // depends on an uncommitted txn.
+  void FinishLockedTxn(Txn* txn, vector<KeyLock>* locks);
+
+  // Commits (or aborts) completed 'txn', whose writes are installed, and
+  // every txn that was waiting only on it to commit, returning each to the
+  // client.
+  void CommitLockedTxns(Txn* txn);
+
+  // Returns a new unique_id. Ids are taken from one atomic counter, so an
+  // id taken after another has returned is larger, which is all that the
+  // age comparisons of TWOPL's deadlock policies and MVCC's timestamps rely
+  // on. A txn numbered later may still be queued first.
+  uint64 NextUniqueId();
+
+  // Queues 'txn' for execution: on its request shard in the
+  // run-to-completion modes, else on 'txn_requests_'.
+  void SubmitTxn(Txn* txn);
+
+  // Starts RunWorker() on every thread of the pool, for the run-to-completion
+  // modes (see RunsToCompletion()).
+  void StartWorkers();
+
+  // Loop of the run-to-completion worker owning request shard 'shard'. It
+  // takes requests from its own shard first and then from the others', and
+  // parks when all are empty.
+  void RunWorker(int shard);
+
+  // OCC version of scheduler with parallel validation. Also runs MOCC, which
+  // differs only in how txns execute: every record has a temperature that
+  // goes up each time a txn fails validation on it and decays over time. A
+  // txn touching a hot record locks its writes and its hot reads in key
+  // order, waiting for them, before it reads anything, so it cannot fail
+  // validation on them. Txns touching only cold records run as under P_OCC.
   void RunOCCParallelScheduler();
+
+  // If 'txn' touches a hot record, sets '*locks' to the locks a MOCC txn
+  // waits for, in key order, and '*optimistic' to the keys it reads
+  // without a lock, with their 'signature', and returns true. Else returns
+  // false.
+  bool MoccLocks(Txn* txn, vector<KeyLock>* locks, set<Key>* optimistic,
+                 KeySignature* signature);
+
+  // Counts a validation failure on each of the records 'keys'.
+  void MoccHeat(const set<Key>& keys);
+
+  // Silo version of OCC. Workers execute, validate and commit txns entirely
+  // on their own: every record has a TID word, a committing txn locks its
+  // writeset's words in key order and then checks that its reads are still
+  // current, with no lock manager and no shared set of active txns. The
+  // scheduler thread only advances the epoch from which commit TIDs are
+  // drawn.
+  void RunSiloScheduler();
+
+  // Executes and commits 'txn' under SILO, restarting it if validation fails.
+  void ExecuteSiloTxn(Txn* txn);
+
+  // Reads the record 'key' into txn's reads for its data type, and sets
+  // '*tid' to the TID of the version read.
+  void SiloRead(Txn* txn, Key key, uint64* tid);
+
+  // TicToc version of OCC. Every record carries a write timestamp (wts) and
+  // a read timestamp (rts) bounding when its current version is valid. A
+  // committing txn computes its own commit timestamp from the records it
+  // touched, extending the rts of records it read where needed, so there is
+  // no global timestamp counter and a txn whose reads are still valid at
+  // some common timestamp commits even if they were overwritten meanwhile.
+  void RunTicTocScheduler();
+
+  // Executes and commits 'txn' under TICTOC, restarting it if validation
+  // fails.
+  void ExecuteTicTocTxn(Txn* txn);
+
+  // Reads the record 'key' into txn's reads for its data type, and sets
+  // '*wts' and '*rts' to the timestamps of the version read.
+  void TicTocRead(Txn* txn, Key key, uint64* wts, uint64* rts);
+
+  // Adaptive scheduler (ADAPTIVE). Runs txns under SILO while contention is
+  // low and under LOCKING while it is high, judging by the restart rate (and
+  // under LOCKING the lock wait time) over the last ADAPTIVE_SLIDE windows.
+  // To switch, it stops admitting txns, waits until every txn admitted under
+  // the old protocol has finished or been restarted, and then admits txns
+  // under the new one, so the two never run side by side.
+  void RunAdaptiveScheduler();
+
+  // Runs 'txn' under SILO, then counts it in 'adaptive_done_'.
+  void ExecuteAdaptiveSiloTxn(Txn* txn);
+
+  // Reads the record 'key' from storage into txn's reads for its data type.
+  void ReadRecord(Txn* txn, Key key);
+
+  // Applies all writes performed by '*txn' for its data type to 'storage_'.
+  //
+  // Requires: txn->Status() is COMPLETED_C.
+  void ApplyWrites(Txn* txn);
+
+  // Clears txn's reads and writes so it can be run again.
+  void ResetTxn(Txn* txn);
   
   // MVCC version of scheduler.
   void RunMVCCScheduler();
@@ -109,32 +431,11 @@ class TxnProcessor {
   // thread for improved two phase locking
   void StartTwoExecuting(Txn* txn);
 
-  // Performs all reads required to execute the transaction, then executes the
-  // transaction logic.
-  void ExecuteTxn(Txn* txn);
-
-  // used for OCC
-  void ExecuteOCCTxn(Txn* txn);
-
-  // Performs all reads required to execute an image transaction, then executes the
-  // transaction logic.
-  void ExecuteImageTxn(Txn* txn);
+  // Releases the first 'acquired' locks of 'setVector' held by a txn that was
+  // aborted as a deadlock victim, then queues the txn for restart.
+  void RestartTwoExecuting(Txn* txn, const vector<pair<Key, bool>>& setVector,
+                           uint64_t acquired);
 
-  void ExecuteStringTxn(Txn* txn);
-
-  void ExecuteBlogStringTxn(Txn* txn);
-
-  // Applies all writes performed by '*txn' to 'storage_'.
-  //
-  // Requires: txn->Status() is COMPLETED_C.
-  void ApplyWrites(Txn* txn);
-
-  void ApplyImageWrites(Txn* txn);
-
-  void ApplyStringWrites(Txn* txn);
-
-  void ApplyBlogStringWrites(Txn* txn);
-  
   // The following functions are for MVCC
   void MVCCExecuteTxn(Txn* txn);
     
@@ -149,15 +450,26 @@ class TxnProcessor {
   // Concurrency control mechanism the TxnProcessor is currently using.
   CCMode mode_;
 
+  // Deadlock prevention policy used by TWOPL.
+  DeadlockPolicy policy_;
+
+  // Dies and wounds counted by the TWOPL scheduler thread.
+  DeadlockStats lock_aborts_;
+
+  // Incoming transaction requests of the run-to-completion modes, sharded
+  // by unique_id_ among the workers, with the notifiers the workers park on.
+  // Declared ahead of 'tp_' so that they outlive the workers.
+  vector<AtomicQueue<Txn*> > request_shards_;
+  vector<EventCount> request_events_;
+
   // Thread pool managing all threads used by TxnProcessor.
   StaticThreadPool tp_;
 
   // Data storage used for all modes.
   Storage* storage_;
 
-  // Next valid unique_id, and a mutex to guard incoming txn requests.
-  int next_unique_id_;
-  Mutex mutex_;
+  // Next valid unique_id, taken with an atomic increment.
+  volatile uint64 next_unique_id_;
 
   // Queue of incoming transaction requests.
   AtomicQueue<Txn*> txn_requests_;
@@ -175,15 +487,60 @@ class TxnProcessor {
   // to client.
   AtomicQueue<Txn*> txn_results_;
   
-  // Set of transactions that are currently in the process of parallel
-  // validation.
-  AtomicSet<Txn*> active_set_;
-
-  // Used it for critical section in parallel occ.
-  Mutex active_set_mutex_;
+  // Writesets of the txns recently validated by P_OCC.
+  ValidationRing validation_ring_;
 
   // Lock Manager used for LOCKING concurrency implementations.
   LockManager* lm_;
+
+  // Restarted txns waiting out their backoff, earliest resubmit time first,
+  // with the retry limit and counters, all guarded by 'delayed_mutex_'.
+  typedef pair<double, Txn*> DelayedTxn;
+  priority_queue<DelayedTxn, vector<DelayedTxn>, greater<DelayedTxn> > delayed_txns_;
+  int max_retries_;
+  RetryStats retry_stats_;
+  Mutex delayed_mutex_;
+
+  // Lock manager threads used by CALVIN.
+  PartitionedLockManager* partitioned_lm_;
+
+  // Current SILO epoch, advanced by the scheduler thread and read by workers
+  // when choosing commit TIDs.
+  volatile uint64 silo_epoch_;
+
+  // Current MOCC decay epoch, advanced by the scheduler thread.
+  volatile uint64 mocc_epoch_;
+
+  // Txns run to the end of an attempt by ADAPTIVE's SILO workers.
+  volatile uint64 adaptive_done_;
+
+  // ADAPTIVE's log, guarded by 'adaptive_mutex_'.
+  vector<AdaptiveWindow> adaptive_windows_;
+  vector<AdaptiveSwitch> adaptive_switches_;
+  Mutex adaptive_mutex_;
+
+  // OCC's commit pipeline. Its stage threads, if any, run on 'stage_tp_'. The
+  // execute and validate counters are kept by the pool and by the scheduler
+  // thread, the pool's busy time in nanoseconds in 'execute_nanos_'.
+  CommitStage* apply_stage_;
+  CommitStage* respond_stage_;
+  AtomicQueue<Txn*> applied_txns_;
+  StaticThreadPool* stage_tp_;
+  CommitStageStats execute_stats_;
+  CommitStageStats validate_stats_;
+  volatile uint64 execute_nanos_;
+  double stages_start_;
+
+  // Notified whenever a txn is requested, completes or is restarted, so the
+  // scheduler thread can park while it has nothing to do. The idle pass
+  // counts are only used by the scheduler thread.
+  EventCount scheduler_event_;
+  int idle_passes_;
+  int spin_limit_;
+
+  // The scheduler thread, which runs until the destructor sets 'stopped_'.
+  pthread_t scheduler_;
+  volatile bool stopped_;
 };
 
 #endif  // _TXN_PROCESSOR_H_
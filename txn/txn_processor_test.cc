@@ -20,10 +20,361 @@ string ModeToString(CCMode mode) {
     case TWOPL:                  return " 2 Phase Locking";
     case TWOPL2:                 return " 2PL";
     case SILO:                   return "SILO";
+    case CALVIN:                 return " Calvin   ";
+    case VLL:                    return " VLL      ";
+    case TICTOC:                 return " TicToc   ";
+    case ADAPTIVE:               return " Adaptive ";
+    case MOCC:                   return " MOCC     ";
     default:                     return "INVALID MODE";
   }
 }
 
+// Returns a human-readable suffix naming the deadlock policy, for the modes
+// that use one.
+string PolicyToString(CCMode mode, DeadlockPolicy policy) {
+  if (mode != TWOPL)
+    return "";
+  switch (policy) {
+    case NO_WAIT:    return " (no-wait)   ";
+    case WAIT_DIE:   return " (wait-die)  ";
+    case WOUND_WAIT: return " (wound-wait)";
+    default:         return " (INVALID POLICY)";
+  }
+}
+
+// Runs 3 RMWs that each read and write the same record in 'mode', and
+// checks that every one commits its increment.
+void CheckReadWriteOverlap(CCMode mode) {
+  TxnProcessor p(mode);
+  set<Key> keys;
+  keys.insert(5);
+
+  for (int i = 0; i < 3; i++) {
+    p.NewTxnRequest(new RMW(keys, keys));
+  }
+  for (int i = 0; i < 3; i++) {
+    Txn* txn = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, txn->Status());
+    delete txn;
+  }
+
+  map<Key, Value> expected;
+  expected[5] = 3;
+  p.NewTxnRequest(new Expect(expected));
+  Txn* txn = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  delete txn;
+}
+
+// A txn reading and writing the same key takes a single lock on it, so it
+// never waits behind itself.
+TEST(TwoPL_ReadWriteOverlap) {
+  CheckReadWriteOverlap(TWOPL);
+  END;
+}
+
+TEST(TwoPL2_ReadWriteOverlap) {
+  CheckReadWriteOverlap(TWOPL2);
+  END;
+}
+
+// Validation finds the lock a txn holds on a record it also read.
+TEST(Silo_ReadWriteOverlap) {
+  CheckReadWriteOverlap(SILO);
+  END;
+}
+
+TEST(TicToc_ReadWriteOverlap) {
+  CheckReadWriteOverlap(TICTOC);
+  END;
+}
+
+TEST(Adaptive_ReadWriteOverlap) {
+  CheckReadWriteOverlap(ADAPTIVE);
+  END;
+}
+
+// Returns an RMW reading one and incrementing two of the records 0..9, and
+// remembers the records it increments in '*writes'.
+Txn* NewCounterRMW(map<Txn*, set<Key> >* writes) {
+  set<Key> readset;
+  set<Key> writeset;
+  readset.insert(rand() % 10);
+  while (writeset.size() < 2) {
+    Key key = rand() % 10;
+    if (readset.count(key) == 0) {
+      writeset.insert(key);
+    }
+  }
+
+  Txn* txn = new RMW(readset, writeset);
+  (*writes)[txn] = writeset;
+  return txn;
+}
+
+// Runs 200 RMWs over 10 records in 'mode', 20 at a time, and checks that
+// every record ends up holding the number of committed txns that wrote it.
+void CheckCommittedWrites(CCMode mode, DeadlockPolicy policy = NO_WAIT) {
+  TxnProcessor p(mode, policy);
+  map<Txn*, set<Key> > writes;
+  map<Key, Value> expected;
+  for (Key key = 0; key < 10; key++) {
+    expected[key] = 0;
+  }
+
+  int submitted = 0;
+  for (; submitted < 20; submitted++) {
+    p.NewTxnRequest(NewCounterRMW(&writes));
+  }
+  for (int finished = 0; finished < submitted; finished++) {
+    Txn* txn = p.GetTxnResult();
+    EXPECT_TRUE(txn->Status() == COMMITTED || txn->Status() == ABORTED);
+    if (txn->Status() == COMMITTED) {
+      for (set<Key>::iterator it = writes[txn].begin();
+           it != writes[txn].end(); ++it) {
+        expected[*it]++;
+      }
+    }
+    writes.erase(txn);
+    delete txn;
+
+    if (submitted < 200) {
+      p.NewTxnRequest(NewCounterRMW(&writes));
+      submitted++;
+    }
+  }
+
+  p.NewTxnRequest(new Expect(expected));
+  Txn* txn = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  delete txn;
+
+  // The check means something only if a wrong expectation aborts.
+  expected[0]++;
+  p.NewTxnRequest(new Expect(expected));
+  txn = p.GetTxnResult();
+  EXPECT_EQ(ABORTED, txn->Status());
+  delete txn;
+}
+
+TEST(Serial_CommittedWrites) {
+  CheckCommittedWrites(SERIAL);
+  END;
+}
+
+TEST(LockingA_CommittedWrites) {
+  CheckCommittedWrites(LOCKING_EXCLUSIVE_ONLY);
+  END;
+}
+
+TEST(LockingB_CommittedWrites) {
+  CheckCommittedWrites(LOCKING);
+  END;
+}
+
+TEST(OCC_CommittedWrites) {
+  CheckCommittedWrites(OCC);
+  END;
+}
+
+// OCC installs and returns committed writes on threads of their own, so the
+// OCC_CommittedWrites check covers the pipeline as it runs by default.
+TEST(OCC_CommitStageWorkers) {
+  TxnProcessor p(OCC);
+  vector<CommitStageStats> stages;
+  p.GetCommitStages(&stages);
+  EXPECT_EQ(4, stages.size());
+  EXPECT_EQ("apply", stages[2].name_);
+  EXPECT_TRUE(stages[2].workers_ > 0);
+  EXPECT_EQ("respond", stages[3].name_);
+  EXPECT_TRUE(stages[3].workers_ > 0);
+  END;
+}
+
+TEST(POCC_CommittedWrites) {
+  CheckCommittedWrites(P_OCC);
+  END;
+}
+
+TEST(TwoPL_CommittedWrites) {
+  CheckCommittedWrites(TWOPL);
+  END;
+}
+
+TEST(TwoPL_WaitDie_CommittedWrites) {
+  CheckCommittedWrites(TWOPL, WAIT_DIE);
+  END;
+}
+
+TEST(TwoPL_WoundWait_CommittedWrites) {
+  CheckCommittedWrites(TWOPL, WOUND_WAIT);
+  END;
+}
+
+TEST(TwoPL2_CommittedWrites) {
+  CheckCommittedWrites(TWOPL2);
+  END;
+}
+
+TEST(Silo_CommittedWrites) {
+  CheckCommittedWrites(SILO);
+  END;
+}
+
+TEST(Calvin_CommittedWrites) {
+  CheckCommittedWrites(CALVIN);
+  END;
+}
+
+TEST(VLL_CommittedWrites) {
+  CheckCommittedWrites(VLL);
+  END;
+}
+
+TEST(TicToc_CommittedWrites) {
+  CheckCommittedWrites(TICTOC);
+  END;
+}
+
+TEST(Adaptive_CommittedWrites) {
+  CheckCommittedWrites(ADAPTIVE);
+  END;
+}
+
+TEST(MOCC_CommittedWrites) {
+  CheckCommittedWrites(MOCC);
+  END;
+}
+
+// Runs 50 RMWs that only write the same record in 'mode', 10 at a time,
+// and checks that none of their increments is lost.
+void CheckBlindWrites(CCMode mode) {
+  TxnProcessor p(mode);
+  set<Key> keys;
+  keys.insert(1);
+
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < 10; j++) {
+      p.NewTxnRequest(new RMW(keys, 0.001));
+    }
+    for (int j = 0; j < 10; j++) {
+      Txn* txn = p.GetTxnResult();
+      EXPECT_EQ(COMMITTED, txn->Status());
+      delete txn;
+    }
+  }
+
+  map<Key, Value> expected;
+  expected[1] = 50;
+  p.NewTxnRequest(new Expect(expected));
+  Txn* txn = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  delete txn;
+}
+
+// A txn denied its only write lock restarts instead of writing unlocked.
+TEST(POCC_BlindWrites) {
+  CheckBlindWrites(P_OCC);
+  END;
+}
+
+TEST(MOCC_BlindWrites) {
+  CheckBlindWrites(MOCC);
+  END;
+}
+
+// Runs 10 RMWs of the same record in 'mode', profiling every lock request,
+// and checks that the profiler finds the record hottest.
+void CheckHottestKey(CCMode mode) {
+  TxnProcessor p(mode);
+  LockProfiler* profiler = p.GetLockProfiler();
+  EXPECT_TRUE(profiler != NULL);
+  profiler->SetSampleRate(1);
+
+  // Each holds the lock for 1ms, so the others queue behind it.
+  set<Key> keys;
+  keys.insert(1);
+  for (int i = 0; i < 10; i++) {
+    p.NewTxnRequest(new RMW(keys, 0.001));
+  }
+  for (int i = 0; i < 10; i++) {
+    delete p.GetTxnResult();
+  }
+
+  vector<KeyContention> top;
+  profiler->TopKeys(1, &top);
+  EXPECT_EQ(1, top.size());
+  EXPECT_EQ(1, top[0].key_);
+  EXPECT_EQ(10, top[0].requests_);
+  EXPECT_TRUE(top[0].denials_ > 0);
+}
+
+TEST(LockingA_HottestKey) {
+  CheckHottestKey(LOCKING_EXCLUSIVE_ONLY);
+  END;
+}
+
+TEST(LockingB_HottestKey) {
+  CheckHottestKey(LOCKING);
+  END;
+}
+
+TEST(Retry_GivesUp) {
+  TxnProcessor p(LOCKING);
+  p.SetMaxRetries(0);
+  set<Key> held;
+  held.insert(1);
+  set<Key> wanted;
+  wanted.insert(1);
+  wanted.insert(2);
+
+  // The second txn cannot take both of its locks while the first holds one
+  // of them for 10ms, and may not be restarted at all.
+  p.NewTxnRequest(new RMW(held, 0.01));
+  p.NewTxnRequest(new RMW(wanted));
+  Txn* txn = p.GetTxnResult();
+  EXPECT_EQ(ABORTED, txn->Status());
+  delete txn;
+  txn = p.GetTxnResult();
+  EXPECT_EQ(COMMITTED, txn->Status());
+  delete txn;
+
+  RetryStats stats;
+  p.GetRetryStats(&stats);
+  EXPECT_EQ(0, stats.restarts_);
+  EXPECT_EQ(1, stats.abandoned_);
+
+  END;
+}
+
+TEST(Retry_BacksOff) {
+  TxnProcessor p(LOCKING);
+  set<Key> held;
+  held.insert(1);
+  set<Key> wanted;
+  wanted.insert(1);
+  wanted.insert(2);
+
+  // The second txn is restarted, after a delay each time, until the first
+  // releases its lock.
+  p.NewTxnRequest(new RMW(held, 0.01));
+  p.NewTxnRequest(new RMW(wanted));
+  for (int i = 0; i < 2; i++) {
+    Txn* txn = p.GetTxnResult();
+    EXPECT_EQ(COMMITTED, txn->Status());
+    delete txn;
+  }
+
+  RetryStats stats;
+  p.GetRetryStats(&stats);
+  EXPECT_TRUE(stats.restarts_ > 0);
+  EXPECT_EQ(0, stats.abandoned_);
+  EXPECT_TRUE(stats.backoff_ > 0);
+  EXPECT_EQ(static_cast<int>(stats.restarts_), stats.max_retries_);
+
+  END;
+}
+
 class LoadGen {
  public:
   virtual ~LoadGen() {}
@@ -73,9 +424,6 @@ class RMWLoadGenFB : public LoadGen {
 
   // }
   virtual Txn* NewTxn() {
-
-    // printf("dbsize_ is %d\n", dbsize_);
-
     int r = rand() % 100;
     if (r < 0) // 0% are numbers
       return new RMW(1, dbsize_, rsetsize_, wsetsize_, wait_time_);
@@ -186,74 +534,163 @@ void Benchmark(const vector<LoadGen*>& lg) {
 
   // For each MODE...
   for (CCMode mode = SERIAL;
-      mode <= SILO;
+      mode <= MOCC;
       mode = static_cast<CCMode>(mode+1)) {
 
-    if (mode != 8){
-      continue;
-    }
-
-
-    // Print out mode name.
-    cout << ModeToString(mode) << flush;
-
-
-    // For each experiment, run 3 times and get the average.
-    for (uint32 exp = 0; exp < lg.size(); exp++) {
-      // printf("made it through here\n");
-      double throughput[3];
-      for (uint32 round = 0; round < 3; round++) {
-        // printf("made it through here\n");
-
-        int txn_count = 0;
-
-        // Create TxnProcessor in next mode.
-        TxnProcessor* p = new TxnProcessor(mode);
-
-        // Record start time.
-        double start = GetTime();
-
-        // printf("made it through here\n");
-
-        // Start specified number of txns running.
-        for (int i = 0; i < active_txns; i++)
-          p->NewTxnRequest(lg[exp]->NewTxn());
-
-        // printf("made it through here\n");
+    // TWOPL is run once per deadlock prevention policy.
+    DeadlockPolicy last_policy = (mode == TWOPL) ? WOUND_WAIT : NO_WAIT;
+    for (DeadlockPolicy policy = NO_WAIT;
+        policy <= last_policy;
+        policy = static_cast<DeadlockPolicy>(policy+1)) {
+      // Print out mode name.
+      cout << ModeToString(mode) << PolicyToString(mode, policy) << flush;
+
+
+      // For each experiment, run 3 times and get the average.
+      for (uint32 exp = 0; exp < lg.size(); exp++) {
+        double throughput[3];
+        int deadlocks = 0;
+        double detection_latency = 0;
+        int dies = 0;
+        int wounds = 0;
+        uint64 restarts = 0;
+        uint64 abandoned = 0;
+        uint64 switches = 0;
+        KeyContention hottest;
+        for (uint32 round = 0; round < 3; round++) {
+          int txn_count = 0;
+
+          // Create TxnProcessor in next mode.
+          TxnProcessor* p = new TxnProcessor(mode, policy);
+
+          // Record start time.
+          double start = GetTime();
+
+          // Start specified number of txns running.
+          for (int i = 0; i < active_txns; i++)
+            p->NewTxnRequest(lg[exp]->NewTxn());
+
+          // Keep 100 active txns at all times for the first full second.
+          while (GetTime() < start + 1) {
+            Txn* txn = p->GetTxnResult();
+            doneTxns.push_back(txn);
+            txn_count++;
+            p->NewTxnRequest(lg[exp]->NewTxn());
+          }
+
+          // Wait for all of them to finish.
+          for (int i = 0; i < active_txns; i++) {
+            Txn* txn = p->GetTxnResult();
+            doneTxns.push_back(txn);
+            txn_count++;
+          }
+
+          // Record end time.
+          double end = GetTime();
+      
+          throughput[round] = txn_count / (end-start);
+
+          // Collect deadlock handling counters, if the mode keeps any.
+          DeadlockStats stats;
+          if (p->GetDeadlockStats(&stats)) {
+            deadlocks += stats.deadlocks_;
+            detection_latency += stats.total_latency_;
+            dies += stats.dies_;
+            wounds += stats.wounds_;
+          }
+
+          // Collect restart counters.
+          RetryStats retries;
+          p->GetRetryStats(&retries);
+          restarts += retries.restarts_;
+          abandoned += retries.abandoned_;
+
+          // Collect protocol switches, if the mode makes any.
+          vector<AdaptiveWindow> windows;
+          vector<AdaptiveSwitch> adaptive_switches;
+          p->GetAdaptiveLog(&windows, &adaptive_switches);
+          switches += adaptive_switches.size();
+
+          // Keep the most contended key seen in any round.
+          LockProfiler* profiler = p->GetLockProfiler();
+          if (profiler != NULL) {
+            vector<KeyContention> top;
+            profiler->TopKeys(1, &top);
+            if (!top.empty() && top[0].denials_ > hottest.denials_)
+              hottest = top[0];
+          }
+
+          doneTxns.clear();
+          delete p;
+        }
+      
+        // Print throughput
+        cout << "\t" << (throughput[0] + throughput[1] + throughput[2]) / 3 << "\t" << flush;
+
+        // Print deadlock count and average time until detection
+        if (deadlocks > 0) {
+          cout << "(" << deadlocks << " deadlocks, "
+               << 1000 * detection_latency / deadlocks << " ms to detect)\t"
+               << flush;
+        }
 
-        // Keep 100 active txns at all times for the first full second.
-        while (GetTime() < start + 1) {
-          Txn* txn = p->GetTxnResult();
-          doneTxns.push_back(txn);
-          txn_count++;
-          p->NewTxnRequest(lg[exp]->NewTxn());
+        // Print aborts caused by the deadlock prevention policy
+        if (dies + wounds > 0) {
+          cout << "(" << dies << " dies, " << wounds << " wounds)\t" << flush;
         }
 
-        // Wait for all of them to finish.
-        for (int i = 0; i < active_txns; i++) {
-          Txn* txn = p->GetTxnResult();
-          doneTxns.push_back(txn);
-          txn_count++;
+        // Print restarts of aborted txns, and txns given up on
+        if (restarts > 0) {
+          cout << "(" << restarts << " restarts, " << abandoned
+               << " given up)\t" << flush;
         }
 
-        // Record end time.
-        double end = GetTime();
-      
-        throughput[round] = txn_count / (end-start);
+        // Print protocol switches
+        if (switches > 0) {
+          cout << "(" << switches << " switches)\t" << flush;
+        }
 
-        doneTxns.clear();
-        delete p;
+        // Print the hottest key among the sampled lock requests
+        if (hottest.denials_ > 0) {
+          cout << "(key " << hottest.key_ << ": " << hottest.denials_ << "/"
+               << hottest.requests_ << " sampled requests denied)\t" << flush;
+        }
       }
-      
-      // Print throughput
-      cout << "\t" << (throughput[0] + throughput[1] + throughput[2]) / 3 << "\t" << flush;
-    }
 
-    cout << endl;
+      cout << endl;
+    }
   }
 }
 
 int main(int argc, char** argv) {
+  TwoPL_ReadWriteOverlap();
+  TwoPL2_ReadWriteOverlap();
+  Silo_ReadWriteOverlap();
+  TicToc_ReadWriteOverlap();
+  Adaptive_ReadWriteOverlap();
+  Serial_CommittedWrites();
+  LockingA_CommittedWrites();
+  LockingB_CommittedWrites();
+  OCC_CommittedWrites();
+  OCC_CommitStageWorkers();
+  POCC_CommittedWrites();
+  TwoPL_CommittedWrites();
+  TwoPL_WaitDie_CommittedWrites();
+  TwoPL_WoundWait_CommittedWrites();
+  TwoPL2_CommittedWrites();
+  Silo_CommittedWrites();
+  Calvin_CommittedWrites();
+  VLL_CommittedWrites();
+  TicToc_CommittedWrites();
+  Adaptive_CommittedWrites();
+  MOCC_CommittedWrites();
+  POCC_BlindWrites();
+  MOCC_BlindWrites();
+  LockingA_HottestKey();
+  LockingB_HottestKey();
+  Retry_GivesUp();
+  Retry_BacksOff();
+
   // cout << "\t\t\t    Average Transaction Duration" << endl;
   // cout << "\t\t0.1ms\t\t1ms\t\t10ms";
   // cout << endl;
@@ -0,0 +1,101 @@
+// Validation structure for OCC with parallel validation (P_OCC).
+
+#include "txn/validation_ring.h"
+
+#include <sched.h>
+
+ValidationRing::ValidationRing() : published_(0), finished_(0) {
+  for (int i = 0; i < VALIDATION_RING_SIZE; i++) {
+    slots_[i].stamp_ = 0;
+    slots_[i].done_ = 0;
+    slots_[i].data_type_ = 0;
+    slots_[i].size_ = 0;
+  }
+}
+
+uint64 ValidationRing::Finished() {
+  return finished_;
+}
+
+uint64 ValidationRing::Publish(const set<Key>& writeset,
+                               const KeySignature& signature, int data_type) {
+  uint64 seq = __sync_add_and_fetch(&published_, 1);
+  Slot* slot = &slots_[seq % VALIDATION_RING_SIZE];
+
+  // the slot's previous txn must have finished (only ever a wait if it is a
+  // whole ring behind)
+  uint64 previous = (seq > VALIDATION_RING_SIZE) ? seq - VALIDATION_RING_SIZE : 0;
+  while (slot->done_ != previous) {
+    sched_yield();
+  }
+
+  slot->stamp_ = 2 * seq - 1;
+  __sync_synchronize();
+  slot->data_type_ = data_type;
+  slot->signature_ = signature;
+  if (writeset.size() > VALIDATION_RING_KEYS) {
+    slot->size_ = -1;
+  } else {
+    slot->size_ = 0;
+    for (set<Key>::const_iterator it = writeset.begin(); it != writeset.end(); ++it) {
+      slot->keys_[slot->size_++] = *it;
+    }
+  }
+  __sync_synchronize();
+  slot->stamp_ = 2 * seq;
+  return seq;
+}
+
+bool ValidationRing::Overlaps(uint64 start, uint64 seq, const set<Key>& readset,
+                              const KeySignature& signature, int data_type) {
+  for (uint64 peer = start + 1; peer < seq; peer++) {
+    Slot* slot = &slots_[peer % VALIDATION_RING_SIZE];
+
+    // wait for the peer to finish publishing; if a later txn has already
+    // taken its slot, assume the worst
+    uint64 stamp;
+    while ((stamp = slot->stamp_) < 2 * peer) {
+      sched_yield();
+    }
+    if (stamp != 2 * peer) {
+      return true;
+    }
+    __sync_synchronize();
+
+    // most writesets share no signature bit with the readset, and need no
+    // key by key check
+    bool overlaps = false;
+    if (slot->data_type_ == data_type and slot->signature_.Intersects(signature)) {
+      if (slot->size_ < 0) {
+        overlaps = true;
+      }
+      for (int i = 0; !overlaps and i < slot->size_; i++) {
+        overlaps = (readset.count(slot->keys_[i]) > 0);
+      }
+    }
+
+    // the keys read are only the peer's if the slot was not reused meanwhile
+    __sync_synchronize();
+    if (overlaps or slot->stamp_ != 2 * peer) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ValidationRing::Finish(uint64 seq) {
+  __sync_synchronize();
+  slots_[seq % VALIDATION_RING_SIZE].done_ = seq;
+  __sync_synchronize();
+
+  // advance the watermark over every finished txn. Whichever of two
+  // neighbouring txns finishes last sees the other done, so it never stalls
+  while (true) {
+    uint64 finished = finished_;
+    uint64 next = finished + 1;
+    if (slots_[next % VALIDATION_RING_SIZE].done_ != next) {
+      return;
+    }
+    __sync_bool_compare_and_swap(&finished_, finished, next);
+  }
+}
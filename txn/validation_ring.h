@@ -0,0 +1,77 @@
+// Validation structure for OCC with parallel validation (P_OCC).
+
+#ifndef _VALIDATION_RING_H_
+#define _VALIDATION_RING_H_
+
+#include <set>
+
+#include "txn/common.h"
+#include "txn/txn.h"
+
+using std::set;
+
+// Number of recent writesets kept by a ValidationRing.
+#define VALIDATION_RING_SIZE 1024
+
+// Largest writeset a ValidationRing slot holds key by key. For a larger
+// writeset only its signature is kept.
+#define VALIDATION_RING_KEYS 32
+
+// Sequence-numbered ring of the writesets of recently validated txns.
+//
+// A txn notes Finished() before it starts reading. When it reaches
+// validation it Publish()es its writeset, which assigns it the next sequence
+// number, and the only txns whose writes it may have missed are those with
+// sequence numbers between the two, so it checks only their writesets
+// (Overlaps()), comparing the sets' signatures first and their keys only
+// when the signatures intersect. Once its writes are applied (or it aborts) it calls Finish().
+// Finished() only advances past a txn once it and every txn before it have
+// finished, so every txn up to it has written everything it is going to.
+//
+// Publishing costs one atomic increment plus a copy of the writeset, no txn
+// waits for another to finish, and nothing is allocated. A validator that falls more than
+// VALIDATION_RING_SIZE txns behind finds its peers' slots reused, and is told
+// it overlaps.
+class ValidationRing {
+ public:
+  ValidationRing();
+
+  // Returns the sequence number up to which every txn has finished.
+  uint64 Finished();
+
+  // Publishes the 'writeset' (with its 'signature') of a txn reading and
+  // writing 'data_type' records, and returns the txn's sequence number.
+  uint64 Publish(const set<Key>& writeset, const KeySignature& signature,
+                 int data_type);
+
+  // Returns true if a txn with sequence number greater than 'start' and less
+  // than 'seq' wrote a key in 'readset' (with 'signature') of the same data
+  // type, or may have, if its writeset is no longer in the ring or was too
+  // large to keep.
+  bool Overlaps(uint64 start, uint64 seq, const set<Key>& readset,
+                const KeySignature& signature, int data_type);
+
+  // Marks txn 'seq' finished.
+  void Finish(uint64 seq);
+
+ private:
+  // One published writeset. 'stamp_' is 2 * seq once txn seq's writeset is
+  // in the slot, and 2 * seq - 1 while it is being copied in. 'done_' is seq
+  // once txn seq has finished.
+  struct Slot {
+    volatile uint64 stamp_;
+    volatile uint64 done_;
+    int data_type_;
+    int size_;  // Number of keys, or -1 if too many to hold.
+    KeySignature signature_;
+    Key keys_[VALIDATION_RING_KEYS];
+  };
+
+  Slot slots_[VALIDATION_RING_SIZE];
+
+  // Last sequence number assigned, and last one finished.
+  volatile uint64 published_;
+  volatile uint64 finished_;
+};
+
+#endif  // _VALIDATION_RING_H_
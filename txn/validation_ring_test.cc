@@ -0,0 +1,82 @@
+// Tests for the P_OCC validation ring.
+
+#include "txn/validation_ring.h"
+
+#include <set>
+
+#include "utils/testing.h"
+
+using std::set;
+
+// Returns the signature of 'keys'.
+static KeySignature Signature(const set<Key>& keys) {
+  KeySignature signature;
+  for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+    signature.Add(*it);
+  }
+  return signature;
+}
+
+TEST(ValidationRing_Overlaps) {
+  ValidationRing ring;
+  set<Key> a, b, reads;
+  a.insert(1);
+  a.insert(2);
+  b.insert(3);
+  reads.insert(2);
+
+  // A txn starting now sees every later writeset, and none before it.
+  uint64 start = ring.Finished();
+  EXPECT_EQ(0, start);
+  uint64 first = ring.Publish(a, Signature(a), 1);
+  uint64 second = ring.Publish(b, Signature(b), 1);
+  EXPECT_EQ(1, first);
+  EXPECT_EQ(2, second);
+  EXPECT_TRUE(ring.Overlaps(start, second + 1, reads, Signature(reads), 1));
+  EXPECT_FALSE(ring.Overlaps(first, second + 1, reads, Signature(reads), 1));
+
+  // Writesets of other data types never overlap.
+  EXPECT_FALSE(ring.Overlaps(start, second + 1, reads, Signature(reads), 2));
+
+  // Finished() only passes txns once every earlier txn has finished.
+  ring.Finish(second);
+  EXPECT_EQ(start, ring.Finished());
+  ring.Finish(first);
+  EXPECT_EQ(second, ring.Finished());
+
+  END;
+}
+
+TEST(ValidationRing_Wraparound) {
+  ValidationRing ring;
+  set<Key> writes, reads;
+  writes.insert(7);
+  reads.insert(8);
+
+  // A validator that falls a whole ring behind is told it overlaps.
+  uint64 start = ring.Finished();
+  uint64 seq = 0;
+  for (int i = 0; i <= VALIDATION_RING_SIZE; i++) {
+    seq = ring.Publish(writes, Signature(writes), 1);
+    ring.Finish(seq);
+  }
+  EXPECT_TRUE(ring.Overlaps(start, seq, reads, Signature(reads), 1));
+  EXPECT_FALSE(ring.Overlaps(seq - 2, seq, reads, Signature(reads), 1));
+
+  // A writeset too large to keep key by key is still found by signature.
+  set<Key> large;
+  for (Key key = 100; key < 100 + VALIDATION_RING_KEYS + 1; key++) {
+    large.insert(key);
+  }
+  uint64 before = ring.Finished();
+  uint64 big = ring.Publish(large, Signature(large), 1);
+  reads.insert(110);
+  EXPECT_TRUE(ring.Overlaps(before, big + 1, reads, Signature(reads), 1));
+
+  END;
+}
+
+int main(int argc, char** argv) {
+  ValidationRing_Overlaps();
+  ValidationRing_Wraparound();
+}
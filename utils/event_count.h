@@ -0,0 +1,68 @@
+/// @file
+///
+/// Notifying a parked EventCount waiter costs one futex wake; notifying
+/// with nobody waiting costs a memory fence and a load.
+
+#ifndef _DB_UTILS_EVENT_COUNT_H_
+#define _DB_UTILS_EVENT_COUNT_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/// @class EventCount
+///
+/// Lets a thread that polls lock-free (or mutex-guarded) queues sleep while
+/// they are empty, without a lost wakeup. The waiter calls PrepareWait(),
+/// checks the queues once more, and then calls either CancelWait() (if it
+/// found work) or Wait(). A producer calls Notify() after pushing. Since the
+/// waiter announces itself before its last check, either that check sees the
+/// push or Notify() sees the waiter.
+class EventCount {
+ public:
+  EventCount() : seq_(0), waiters_(0) {}
+
+  /// Wakes the waiting threads, if any.
+  inline void Notify() {
+    __sync_synchronize();
+    if (waiters_ > 0) {
+      __sync_fetch_and_add(&seq_, 1);
+      syscall(SYS_futex, &seq_, FUTEX_WAKE_PRIVATE, INT_MAX_WAKE, NULL, NULL, 0);
+    }
+  }
+
+  /// Announces that the caller is about to wait, and returns the key to pass
+  /// to Wait().
+  inline int PrepareWait() {
+    __sync_fetch_and_add(&waiters_, 1);
+    return seq_;
+  }
+
+  /// Withdraws a PrepareWait() that is not followed by Wait().
+  inline void CancelWait() {
+    __sync_fetch_and_sub(&waiters_, 1);
+  }
+
+  /// Sleeps until Notify() is called after the PrepareWait() that returned
+  /// 'key', or until 'timeout' seconds have passed.
+  inline void Wait(int key, double timeout) {
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout);
+    ts.tv_nsec = static_cast<long>((timeout - ts.tv_sec) * 1e9);
+    syscall(SYS_futex, &seq_, FUTEX_WAIT_PRIVATE, key, &ts, NULL, 0);
+    __sync_fetch_and_sub(&waiters_, 1);
+  }
+
+ private:
+  // Largest number of threads a futex wake is asked to wake.
+  static const int INT_MAX_WAKE = 0x7fffffff;
+
+  // Bumped by every Notify() that finds a waiter. A futex word, so an int.
+  volatile int seq_;
+
+  // Threads between PrepareWait() and the end of Wait() or CancelWait().
+  volatile int waiters_;
+};
+
+#endif  // _DB_UTILS_EVENT_COUNT_H_
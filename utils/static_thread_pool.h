@@ -13,6 +13,7 @@
 #include <vector>
 #include <utility>
 #include "utils/atomic.h"
+#include "utils/event_count.h"
 #include "utils/thread_pool.h"
 
 using std::queue;
@@ -20,6 +21,11 @@ using std::string;
 using std::vector;
 using std::pair;
 
+// Sleeps at the longest backoff an idle thread takes before it parks, and the
+// longest it stays parked before checking whether the pool has stopped.
+#define IDLE_SLEEPS_BEFORE_PARKING 32
+#define PARK_TIMEOUT 0.01
+
 //
 class StaticThreadPool : public ThreadPool {
  public:
@@ -30,7 +36,18 @@ class StaticThreadPool : public ThreadPool {
 
 
   ~StaticThreadPool() {
+    Stop();
+    delete[] events_;
+  }
+
+  // Runs the tasks already queued, then joins every thread. No task may be
+  // queued afterwards. Does nothing if the pool has stopped already.
+  void Stop() {
+    if (stopped_)
+      return;
     stopped_ = true;
+    for (int i = 0; i < thread_count_; i++)
+      events_[i].Notify();
     for (int i = 0; i < thread_count_; i++)
       pthread_join(threads_[i], NULL);
   }
@@ -39,7 +56,19 @@ class StaticThreadPool : public ThreadPool {
 
   virtual void RunTask(Task* task) {
     assert(!stopped_);
-    while (!queues_[rand() % thread_count_].PushNonBlocking(task)) {}
+    int i;
+    do {
+      i = rand() % thread_count_;
+    } while (!queues_[i].PushNonBlocking(task));
+    events_[i].Notify();
+  }
+
+  // Runs 'task' on thread 'i' of the pool, after any task queued before it
+  // there.
+  void RunTaskOn(int i, Task* task) {
+    assert(!stopped_);
+    queues_[i].Push(task);
+    events_[i].Notify();
   }
 
   virtual int ThreadCount() { return thread_count_; }
@@ -48,6 +77,7 @@ class StaticThreadPool : public ThreadPool {
   void Start() {
     threads_.resize(thread_count_);
     queues_.resize(thread_count_);
+    events_ = new EventCount[thread_count_];
     
     // Pin all threads in the thread pool to CPU Core 0 ~ 6
     cpu_set_t cpuset;
@@ -78,17 +108,29 @@ class StaticThreadPool : public ThreadPool {
     
     Task* task;
     int sleep_duration = 1;  // in microseconds
+    int idle_sleeps = 0;
     while (true) {
       if (tp->queues_[queue_id].PopNonBlocking(&task)) {
         task->Run();
         delete task;
         // Reset backoff.
         sleep_duration = 1;
-      } else {
+        idle_sleeps = 0;
+      } else if (idle_sleeps < IDLE_SLEEPS_BEFORE_PARKING) {
         usleep(sleep_duration);
         // Back off exponentially.
         if (sleep_duration < 32)
           sleep_duration *= 2;
+        else
+          idle_sleeps++;
+      } else {
+        // Park until a task is queued here.
+        EventCount* event = &tp->events_[queue_id];
+        int key = event->PrepareWait();
+        if (tp->queues_[queue_id].Size() > 0 or tp->stopped_)
+          event->CancelWait();
+        else
+          event->Wait(key, PARK_TIMEOUT);
       }
 
       if (tp->stopped_) {
@@ -110,6 +152,9 @@ class StaticThreadPool : public ThreadPool {
   // Task queues.
   vector<AtomicQueue<Task*> > queues_;
 
+  // Notified when a task is queued on the matching queue.
+  EventCount* events_;
+
   bool stopped_;
 };
 